@@ -3,6 +3,7 @@
 #include <string.h>
 #include <net/if.h>
 #include <errno.h>
+#include <stdint.h>
 #include <linux/if_link.h>
 
 #include "cmd_args.h"
@@ -17,7 +18,7 @@ int option_wrappers_to_options(
         ;
     wrapper_size = i;
 
-    struct option *new_opts = malloc(sizeof(struct option) * wrapper_size);
+    struct option *new_opts = calloc(wrapper_size + 1, sizeof(struct option));
     if (!new_opts)
     {
         return -1;
@@ -99,6 +100,105 @@ void parse_cmd_args(
         case 5:
             cfg->need_pin = true;
             break;
+        case 6:
+            tmp_dest_addr = (char *)&cfg->ts_filename;
+            strncpy(tmp_dest_addr, optarg, sizeof(cfg->ts_filename));
+            break;
+        case 7:
+            cfg->ts_entries = strtoull(optarg, NULL, 10);
+            if (!cfg->ts_entries)
+            {
+                fprintf(stderr, "ERR: --ts-entries must be positive\n");
+                goto error;
+            }
+            break;
+        case 8:
+            cfg->query_window = strtoul(optarg, NULL, 10);
+            break;
+        case 9:
+            cfg->query_end = strtoul(optarg, NULL, 10);
+            break;
+        case 10:
+            tmp_dest_addr = (char *)&cfg->lb_conf;
+            strncpy(tmp_dest_addr, optarg, sizeof(cfg->lb_conf));
+            break;
+        case 11:
+            tmp_dest_addr = (char *)&cfg->tc_filename;
+            strncpy(tmp_dest_addr, optarg, sizeof(cfg->tc_filename));
+            break;
+        case 12:
+            cfg->no_count_bytes = true;
+            break;
+        case 13:
+            cfg->size_hist = true;
+            break;
+        case 14:
+            tmp_dest_addr = (char *)&cfg->filter_file;
+            strncpy(tmp_dest_addr, optarg, sizeof(cfg->filter_file));
+            break;
+        case 15:
+        {
+            long rate = strtol(optarg, NULL, 10);
+            if (rate < 1 || rate > UINT32_MAX)
+            {
+                fprintf(stderr, "ERR: --sample must be at least 1\n");
+                goto error;
+            }
+            cfg->sample_rate = rate;
+            break;
+        }
+        case 16:
+            tmp_dest_addr = (char *)&cfg->tun_file;
+            strncpy(tmp_dest_addr, optarg, sizeof(cfg->tun_file));
+            break;
+        case 17:
+            tmp_dest_addr = (char *)&cfg->rules_file;
+            strncpy(tmp_dest_addr, optarg, sizeof(cfg->rules_file));
+            break;
+        case 18:
+            cfg->filter_size = strtoul(optarg, NULL, 10);
+            if (!cfg->filter_size)
+            {
+                fprintf(stderr, "ERR: --filter-size must be positive\n");
+                goto error;
+            }
+            break;
+        case 19:
+            tmp_dest_addr = (char *)&cfg->pcap_file;
+            strncpy(tmp_dest_addr, optarg, sizeof(cfg->pcap_file));
+            break;
+        case 20:
+            cfg->replay_threads = strtoul(optarg, NULL, 10);
+            if (!cfg->replay_threads)
+            {
+                fprintf(stderr, "ERR: --threads must be positive\n");
+                goto error;
+            }
+            break;
+        case 21:
+            cfg->replay_batch = strtoul(optarg, NULL, 10);
+            if (!cfg->replay_batch)
+            {
+                fprintf(stderr, "ERR: --batch must be positive\n");
+                goto error;
+            }
+            break;
+        case 22:
+            cfg->replay_repeat = strtoul(optarg, NULL, 10);
+            if (!cfg->replay_repeat)
+            {
+                fprintf(stderr, "ERR: --repeat must be positive\n");
+                goto error;
+            }
+            break;
+        case 23:
+            cfg->bloom_fp = strtod(optarg, NULL);
+            if (cfg->bloom_fp <= 0 || cfg->bloom_fp >= 1)
+            {
+                fprintf(stderr, "ERR: --bloom-fp must be between 0 and 1\n");
+                goto error;
+            }
+            break;
         error:
         default:
             free(opts);
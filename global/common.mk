@@ -34,13 +34,13 @@ clean:
 	rm -rf $(LIBBPF_DIR)/build
 	$(MAKE) -C $(LIBBPF_DIR) clean
 	$(MAKE) -C $(COMMON_DIR) clean
-	rm -f $(XDP_OBJ) $(USER_TARGET)
+	rm -f $(XDP_OBJ) $(USER_TARGET) $(USER_OBJS)
 	rm -f *.ll
 	rm -f *~
 
 COMMON_MK = $(COMMON_DIR)/common.mk
 
-COMMON_OBJS += $(COMMON_DIR)/cmd_args.o $(COMMON_DIR)/xdp_helper.o
+COMMON_OBJS += $(COMMON_DIR)/cmd_args.o $(COMMON_DIR)/xdp_helper.o $(COMMON_DIR)/ts_ring.o $(COMMON_DIR)/maglev.o $(COMMON_DIR)/map_resize.o $(COMMON_DIR)/map_batch.o
 $(COMMON_OBJS):
 	make -C $(COMMON_DIR)
 
@@ -54,9 +54,13 @@ $(OBJECT_LIBBPF):
 		mkdir -p build; $(MAKE) install_headers DESTDIR=build OBJDIR=.; \
 	fi
 
-$(USER_TARGET): %: %.c $(OBJECT_LIBBPF) Makefile $(COMMON_MK) $(COMMON_OBJS)
+# Extra per-directory userspace modules, linked into every USER_TARGET
+$(USER_OBJS): %.o: %.c %.h $(OBJECT_LIBBPF) Makefile $(COMMON_MK)
+	$(CC) -Wall $(USER_CFLAGS) -c -o $@ $<
+
+$(USER_TARGET): %: %.c $(OBJECT_LIBBPF) Makefile $(COMMON_MK) $(COMMON_OBJS) $(USER_OBJS)
 	mkdir -p $(OUTPUT_DIR)
-	$(CC) -Wall $(USER_CFLAGS) $(LDFLAGS) -o $(OUTPUT_DIR)/$@ $(COMMON_OBJS) $< $(LIBS)
+	$(CC) -Wall $(USER_CFLAGS) $(LDFLAGS) -o $(OUTPUT_DIR)/$@ $(COMMON_OBJS) $(USER_OBJS) $< $(LIBS)
 
 $(XDP_OBJ): %.o: %.c $(OBJECT_LIBBPF) Makefile $(COMMON_MK)
 	mkdir -p $(OUTPUT_DIR)
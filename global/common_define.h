@@ -3,6 +3,7 @@
 
 #include <net/if.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <linux/types.h>
 
 struct config
@@ -20,6 +21,32 @@ struct config
     char pin_dir[512];
     char mapname[512];
     __u32 xdp_flags;
+
+    char ts_filename[512];
+    __u64 ts_entries;
+    __u32 query_window;
+    __u32 query_end;
+
+    char lb_conf[512];
+    char tc_filename[512];
+
+    bool no_count_bytes;
+    bool size_hist;
+    char filter_file[512];
+    __u32 filter_size;
+    double bloom_fp;
+    __u32 sample_rate;
+    char tun_file[512];
+    char rules_file[512];
+    char pcap_file[512];
+    __u32 replay_threads;
+    __u32 replay_batch;
+    __u32 replay_repeat;
+    /* Initial .rodata image of the XDP object, NULL keeps its defaults */
+    const void *rodata;
+    size_t rodata_sz;
+    /* NULL-terminated maps that .rodata leaves unread, see stub_bpf_obj_maps() */
+    const char *const *stub_maps;
 };
 
 #define EXIT_OK 0
@@ -34,6 +61,8 @@ struct config
 #define XDP_ACTION_MAX XDP_UNKNOWN + 1
 #endif
 
+#define NANOSEC_PER_SEC 1000000000
+
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <errno.h>
+
+#include "maglev.h"
+
+/* splitmix64, two seeds give the offset and skip permutation inputs */
+static __u64 maglev_hash(__u64 key, __u64 seed)
+{
+    __u64 z = key + seed + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+int maglev_populate(__u32 *table, __u32 size, const __u64 *keys, const __u32 *ids, __u32 nr)
+{
+    if (!nr || size < 2)
+    {
+        return -EINVAL;
+    }
+
+    __u64 *offset = calloc(nr, sizeof(*offset));
+    __u64 *skip = calloc(nr, sizeof(*skip));
+    __u64 *next = calloc(nr, sizeof(*next));
+    char *taken = calloc(size, sizeof(*taken));
+    if (!offset || !skip || !next || !taken)
+    {
+        free(offset);
+        free(skip);
+        free(next);
+        free(taken);
+        return -ENOMEM;
+    }
+
+    for (__u32 i = 0; i < nr; i++)
+    {
+        offset[i] = maglev_hash(keys[i], 0xcbf29ce484222325ULL) % size;
+        skip[i] = maglev_hash(keys[i], 0x100000001b3ULL) % (size - 1) + 1;
+    }
+
+    __u32 filled = 0;
+    while (filled < size)
+    {
+        for (__u32 i = 0; i < nr && filled < size; i++)
+        {
+            __u64 slot;
+            do
+            {
+                slot = (offset[i] + next[i] * skip[i]) % size;
+                next[i]++;
+            } while (taken[slot]);
+
+            taken[slot] = 1;
+            table[slot] = ids[i];
+            filled++;
+        }
+    }
+
+    free(offset);
+    free(skip);
+    free(next);
+    free(taken);
+    return 0;
+}
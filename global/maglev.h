@@ -0,0 +1,14 @@
+#ifndef __COMMON_MAGLEV_H
+#define __COMMON_MAGLEV_H
+
+#include <linux/types.h>
+
+/*
+ * Maglev consistent hashing (Eisenbud et al., NSDI'16). Fills table[size]
+ * with ids[], where each backend is identified by a stable keys[] value.
+ * size must be prime. Backends keep most of their slots when others are
+ * added or removed, so only a small share of flows move.
+ */
+int maglev_populate(__u32 *table, __u32 size, const __u64 *keys, const __u32 *ids, __u32 nr);
+
+#endif
@@ -0,0 +1,41 @@
+#include <errno.h>
+
+#include <bpf/bpf.h>
+
+#include "map_batch.h"
+
+/* Kernel-internal errno, what older kernels return for unsupported commands */
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
+
+bool map_batch_unsupported(int err)
+{
+    return err == EINVAL || err == ENOTSUPP || err == EOPNOTSUPP;
+}
+
+int map_update_batch_compat(int map_fd, void *keys, void *values, __u32 count,
+                            __u32 key_size, __u32 value_size)
+{
+    __u32 n = count;
+    if (!bpf_map_update_batch(map_fd, keys, values, &n, NULL))
+    {
+        return 0;
+    }
+
+    int err = errno;
+    if (!map_batch_unsupported(err))
+    {
+        return -err;
+    }
+
+    for (__u32 i = 0; i < count; i++)
+    {
+        if (bpf_map_update_elem(map_fd, (char *)keys + i * key_size,
+                                (char *)values + i * value_size, BPF_ANY))
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef __COMMON_MAP_BATCH_H
+#define __COMMON_MAP_BATCH_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+/*
+ * Batch map ops arrived in kernel 5.6. Older kernels reject the commands,
+ * only then do callers fall back to one syscall per element; any other
+ * error (E2BIG on a full table) is the caller's to handle.
+ */
+bool map_batch_unsupported(int err);
+
+/* bpf_map_update_batch() with BPF_ANY, per element without batch ops. Returns negative errno */
+int map_update_batch_compat(int map_fd, void *keys, void *values, __u32 count,
+                            __u32 key_size, __u32 value_size);
+
+#endif
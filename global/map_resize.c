@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_define.h"
+#include "xdp_helper.h"
+#include "map_resize.h"
+#include "map_batch.h"
+
+#define MAP_COPY_BATCH 1024
+
+int map_in_map_get(int outer_fd, __u32 slot)
+{
+    __u32 id;
+    if (bpf_map_lookup_elem(outer_fd, &slot, &id))
+    {
+        return -errno;
+    }
+
+    int fd = bpf_map_get_fd_by_id(id);
+    return fd < 0 ? -errno : fd;
+}
+
+static __u32 map_value_size(const struct bpf_map_info *info)
+{
+    switch (info->type)
+    {
+    case BPF_MAP_TYPE_PERCPU_HASH:
+    case BPF_MAP_TYPE_PERCPU_ARRAY:
+    case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+        return ((info->value_size + 7) & ~7) * libbpf_num_possible_cpus();
+    default:
+        return info->value_size;
+    }
+}
+
+static int map_copy_one_by_one(int src_fd, int dst_fd, __u32 key_size, __u32 value_size)
+{
+    void *key = malloc(key_size), *next = malloc(key_size), *value = malloc(value_size);
+    void *prev_key = NULL;
+    int err = 0;
+
+    if (!key || !next || !value)
+    {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    while (!bpf_map_get_next_key(src_fd, prev_key, next))
+    {
+        if (!bpf_map_lookup_elem(src_fd, next, value) &&
+            bpf_map_update_elem(dst_fd, next, value, BPF_ANY))
+        {
+            err = -errno;
+            break;
+        }
+        memcpy(key, next, key_size);
+        prev_key = key;
+    }
+
+out:
+    free(key);
+    free(next);
+    free(value);
+    return err;
+}
+
+int map_copy_entries(int src_fd, int dst_fd)
+{
+    struct bpf_map_info info = {0};
+    __u32 info_len = sizeof(info);
+    if (bpf_obj_get_info_by_fd(src_fd, &info, &info_len))
+    {
+        return -errno;
+    }
+
+    __u32 value_size = map_value_size(&info);
+    /* hash maps resume from a bucket index, arrays from a key */
+    __u32 token_size = info.key_size > sizeof(__u64) ? info.key_size : sizeof(__u64);
+    void *keys = calloc(MAP_COPY_BATCH, info.key_size);
+    void *values = calloc(MAP_COPY_BATCH, value_size);
+    void *in_batch = calloc(1, token_size), *out_batch = calloc(1, token_size);
+    int err = 0;
+
+    if (!keys || !values || !in_batch || !out_batch)
+    {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    bool first = true, done = false;
+    while (!done)
+    {
+        __u32 count = MAP_COPY_BATCH;
+        if (bpf_map_lookup_batch(src_fd, first ? NULL : in_batch, out_batch, keys, values, &count, NULL))
+        {
+            if (errno != ENOENT)
+            {
+                err = first && map_batch_unsupported(errno) ? map_copy_one_by_one(src_fd, dst_fd, info.key_size, value_size) : -errno;
+                goto out;
+            }
+            done = true;
+        }
+        first = false;
+        memcpy(in_batch, out_batch, token_size);
+
+        err = count ? map_update_batch_compat(dst_fd, keys, values, count, info.key_size, value_size) : 0;
+        if (err)
+        {
+            goto out;
+        }
+    }
+
+out:
+    free(keys);
+    free(values);
+    free(in_batch);
+    free(out_batch);
+    return err;
+}
+
+int map_in_map_resize(int outer_fd, __u32 slot, __u32 max_entries)
+{
+    int old_fd = map_in_map_get(outer_fd, slot);
+    if (old_fd < 0)
+    {
+        return old_fd;
+    }
+
+    struct bpf_map_info info = {0};
+    __u32 info_len = sizeof(info);
+    if (bpf_obj_get_info_by_fd(old_fd, &info, &info_len))
+    {
+        int err = -errno;
+        close(old_fd);
+        return err;
+    }
+
+    int new_fd = bpf_create_map_name(info.type, info.name, info.key_size, info.value_size, max_entries, info.map_flags);
+    if (new_fd < 0)
+    {
+        int err = -errno;
+        fprintf(stderr, "ERR: create map(%s) with %u entries failed(%d): %s\n", info.name, max_entries, -err, strerror(-err));
+        close(old_fd);
+        return err;
+    }
+
+    int err = map_copy_entries(old_fd, new_fd);
+    if (err)
+    {
+        fprintf(stderr, "ERR: copy map(%s) failed(%d): %s\n", info.name, -err, strerror(-err));
+        goto out;
+    }
+
+    if (bpf_map_update_elem(outer_fd, &slot, &new_fd, BPF_ANY))
+    {
+        err = -errno;
+        fprintf(stderr, "ERR: swap map(%s) into slot %u failed(%d): %s\n", info.name, slot, -err, strerror(-err));
+        goto out;
+    }
+
+    /* Read the slot back, another resizer may have won the race */
+    struct bpf_map_info expected = {
+        .type = info.type,
+        .key_size = info.key_size,
+        .value_size = info.value_size,
+        .max_entries = max_entries,
+    };
+    struct bpf_map_info curr = {0};
+    int curr_fd = map_in_map_get(outer_fd, slot);
+    if (check_map_fd_info(curr_fd, &curr, &expected))
+    {
+        err = -EAGAIN;
+    }
+    if (curr_fd >= 0)
+    {
+        close(curr_fd);
+    }
+    if (err)
+    {
+        goto out;
+    }
+
+    printf("INFO: map(%s) resized %u -> %u entries\n", info.name, info.max_entries, max_entries);
+
+out:
+    close(new_fd);
+    close(old_fd);
+    return err;
+}
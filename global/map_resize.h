@@ -0,0 +1,20 @@
+#ifndef __COMMON_MAP_RESIZE_H
+#define __COMMON_MAP_RESIZE_H
+
+#include <linux/types.h>
+
+/*
+ * Online resizing of tables held in a BPF_MAP_TYPE_ARRAY_OF_MAPS or
+ * HASH_OF_MAPS slot. A larger copy of the inner map is built next to the
+ * live one and swapped into the slot, the datapath sees either table.
+ * Entries written to the old table during the copy are lost, so the
+ * caller must own all writes (the datapath only reads). Inner maps of a
+ * different size need kernel 5.10, arrays also BPF_F_INNER_MAP.
+ */
+
+/* fd of the map currently in slot, or negative errno */
+int map_in_map_get(int outer_fd, __u32 slot);
+int map_copy_entries(int src_fd, int dst_fd);
+int map_in_map_resize(int outer_fd, __u32 slot, __u32 max_entries);
+
+#endif
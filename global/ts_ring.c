@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "common_define.h"
+#include "ts_ring.h"
+
+static size_t ts_ring_file_len(__u64 capacity)
+{
+    return TS_RING_DATA_OFF + capacity * sizeof(struct ts_ring_entry);
+}
+
+static int ts_ring_map(struct ts_ring *ring, int fd, size_t len, int prot)
+{
+    void *addr = mmap(NULL, len, prot, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: %s() mmap failed(%d): %s\n", __func__, err, strerror(err));
+        return -err;
+    }
+
+    ring->fd = fd;
+    ring->map_len = len;
+    ring->hdr = addr;
+    ring->entries = (struct ts_ring_entry *)((char *)addr + TS_RING_DATA_OFF);
+    return 0;
+}
+
+static int ts_ring_hdr_valid(const struct ts_ring_hdr *hdr)
+{
+    return hdr->magic == TS_RING_MAGIC &&
+           hdr->version == TS_RING_VERSION &&
+           hdr->entry_size == sizeof(struct ts_ring_entry) &&
+           hdr->nr_actions == XDP_ACTION_MAX &&
+           hdr->capacity;
+}
+
+int ts_ring_open(struct ts_ring *ring, const char *filename, __u64 capacity, const char *netif_name, int netif_idx)
+{
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: %s() open file(%s) failed(%d): %s\n", __func__, filename, err, strerror(err));
+        return -err;
+    }
+
+    /* One writer per ring, a second poller would interleave entries */
+    if (flock(fd, LOCK_EX | LOCK_NB))
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: %s() file(%s) is locked by another writer(%d): %s\n", __func__, filename, err, strerror(err));
+        close(fd);
+        return -err;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: %s() stat file(%s) failed(%d): %s\n", __func__, filename, err, strerror(err));
+        close(fd);
+        return -err;
+    }
+
+    /* Reuse the history of a previous run if the file layout matches */
+    struct ts_ring_hdr old = {0};
+    bool reuse = st.st_size > 0;
+    if (reuse && (pread(fd, &old, sizeof(old), 0) != sizeof(old) || !ts_ring_hdr_valid(&old) ||
+                  (size_t)st.st_size < ts_ring_file_len(old.capacity)))
+    {
+        /* Never clobber a file we did not create, the path may be a typo */
+        fprintf(stderr, "ERR: %s() file(%s) exists and is not a valid ts file\n", __func__, filename);
+        close(fd);
+        return -EINVAL;
+    }
+    if (reuse && capacity && capacity != old.capacity)
+    {
+        fprintf(stderr, "ERR: %s() file(%s) holds %llu entries, requested %llu\n",
+                __func__, filename, old.capacity, capacity);
+        close(fd);
+        return -EINVAL;
+    }
+
+    /* Cumulative counters of two devices in one history give bogus rates */
+    const char *name = netif_name ? netif_name : "";
+    if (reuse && old.netif_name[0] && strncmp(old.netif_name, name, IF_NAMESIZE))
+    {
+        fprintf(stderr, "ERR: %s() file(%s) records dev %.*s, not %s\n",
+                __func__, filename, IF_NAMESIZE, old.netif_name, name);
+        close(fd);
+        return -EINVAL;
+    }
+
+    if (reuse)
+    {
+        capacity = old.capacity;
+    }
+    else if (!capacity)
+    {
+        capacity = TS_RING_DEFAULT_ENTRIES;
+    }
+
+    size_t len = ts_ring_file_len(capacity);
+    if (!reuse)
+    {
+        /* Allocate all blocks now so the poll loop never extends the file */
+        int err = posix_fallocate(fd, 0, len);
+        if (err)
+        {
+            fprintf(stderr, "ERR: %s() preallocate file(%s) failed(%d): %s\n", __func__, filename, err, strerror(err));
+            close(fd);
+            return -err;
+        }
+    }
+
+    int err = ts_ring_map(ring, fd, len, PROT_READ | PROT_WRITE);
+    if (err)
+    {
+        close(fd);
+        return err;
+    }
+
+    if (!reuse)
+    {
+        struct ts_ring_hdr *hdr = ring->hdr;
+        hdr->version = TS_RING_VERSION;
+        hdr->entry_size = sizeof(struct ts_ring_entry);
+        hdr->nr_actions = XDP_ACTION_MAX;
+        hdr->capacity = capacity;
+        hdr->head = 0;
+        /* Readers key on the magic, publish it last */
+        __atomic_store_n(&hdr->magic, TS_RING_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    /* The ifindex of the same name may change across reboots */
+    ring->hdr->netif_idx = netif_idx;
+    strncpy(ring->hdr->netif_name, name, IF_NAMESIZE - 1);
+
+    printf("INFO: %s ts file(%s) entries(%llu) head(%llu)\n",
+           reuse ? "reuse" : "create", filename, capacity, ring->hdr->head);
+    return 0;
+}
+
+int ts_ring_open_ro(struct ts_ring *ring, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: %s() open file(%s) failed(%d): %s\n", __func__, filename, err, strerror(err));
+        return -err;
+    }
+
+    struct ts_ring_hdr hdr;
+    struct stat st;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || !ts_ring_hdr_valid(&hdr) ||
+        fstat(fd, &st) || (size_t)st.st_size < ts_ring_file_len(hdr.capacity))
+    {
+        fprintf(stderr, "ERR: %s() file(%s) is not a valid ts file\n", __func__, filename);
+        close(fd);
+        return -EINVAL;
+    }
+
+    int err = ts_ring_map(ring, fd, ts_ring_file_len(hdr.capacity), PROT_READ);
+    if (err)
+    {
+        close(fd);
+    }
+    return err;
+}
+
+void ts_ring_close(struct ts_ring *ring)
+{
+    if (ring->hdr)
+    {
+        munmap(ring->hdr, ring->map_len);
+        ring->hdr = NULL;
+        ring->entries = NULL;
+    }
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+struct ts_ring_entry *ts_ring_begin(struct ts_ring *ring)
+{
+    struct ts_ring_hdr *hdr = ring->hdr;
+    struct ts_ring_entry *entry = &ring->entries[hdr->head % hdr->capacity];
+
+    /* Mark the slot torn before any counter in it changes */
+    __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return entry;
+}
+
+void ts_ring_commit(struct ts_ring *ring, struct ts_ring_entry *entry)
+{
+    struct ts_ring_hdr *hdr = ring->hdr;
+    __u64 head = hdr->head + 1;
+
+    __atomic_store_n(&entry->seq, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->head, head, __ATOMIC_RELEASE);
+}
+
+__u64 ts_ring_head(const struct ts_ring *ring)
+{
+    return __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+__u64 ts_ring_tail(const struct ts_ring *ring)
+{
+    __u64 head = ts_ring_head(ring);
+    return head > ring->hdr->capacity ? head - ring->hdr->capacity : 0;
+}
+
+int ts_ring_read(const struct ts_ring *ring, __u64 seq, struct ts_ring_entry *out)
+{
+    const struct ts_ring_entry *entry = &ring->entries[seq % ring->hdr->capacity];
+
+    __u64 before = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if (before != seq + 1)
+    {
+        return -EAGAIN;
+    }
+
+    memcpy(out, entry, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    /* Writer lapped us while copying */
+    if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != before)
+    {
+        return -EAGAIN;
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef __COMMON_TS_RING_H
+#define __COMMON_TS_RING_H
+
+#include <stddef.h>
+#include <net/if.h>
+#include <linux/types.h>
+#include <linux/bpf.h>
+
+#include "common_define.h"
+
+/*
+ * On-disk layout of the counter time-series file:
+ *
+ *   [0, TS_RING_DATA_OFF)   struct ts_ring_hdr
+ *   [TS_RING_DATA_OFF, ...) capacity * struct ts_ring_entry
+ *
+ * The writer owns the file through a shared mapping and only does plain
+ * stores into it. Record N lives in slot N % capacity; hdr->head is the
+ * number of records ever written.
+ */
+#define TS_RING_MAGIC 0x58445453 /* "XDTS" */
+#define TS_RING_VERSION 1
+#define TS_RING_DATA_OFF 4096
+#define TS_RING_DEFAULT_ENTRIES 43200
+
+struct ts_ring_counter
+{
+    __u64 pkts;
+    __u64 bytes;
+};
+
+struct ts_ring_entry
+{
+    /* seq + 1 of the record in this slot, 0 while it is being written */
+    __u64 seq;
+    /* CLOCK_REALTIME in ns, so history stays comparable across restarts */
+    __u64 ts;
+    struct ts_ring_counter act[XDP_ACTION_MAX];
+};
+
+struct ts_ring_hdr
+{
+    __u32 magic;
+    __u32 version;
+    __u32 entry_size;
+    __u32 nr_actions;
+    __u64 capacity;
+    __u64 head;
+    __u32 netif_idx;
+    char netif_name[IF_NAMESIZE];
+};
+
+struct ts_ring
+{
+    int fd;
+    size_t map_len;
+    struct ts_ring_hdr *hdr;
+    struct ts_ring_entry *entries;
+};
+
+int ts_ring_open(struct ts_ring *ring, const char *filename, __u64 capacity, const char *netif_name, int netif_idx);
+int ts_ring_open_ro(struct ts_ring *ring, const char *filename);
+void ts_ring_close(struct ts_ring *ring);
+
+struct ts_ring_entry *ts_ring_begin(struct ts_ring *ring);
+void ts_ring_commit(struct ts_ring *ring, struct ts_ring_entry *entry);
+
+__u64 ts_ring_head(const struct ts_ring *ring);
+__u64 ts_ring_tail(const struct ts_ring *ring);
+int ts_ring_read(const struct ts_ring *ring, __u64 seq, struct ts_ring_entry *out);
+
+#endif
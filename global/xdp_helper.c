@@ -3,6 +3,8 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <linux/types.h>
 #include <linux/if_link.h>
@@ -84,27 +86,10 @@ int xdp_link_detach(int ifidx, __u32 xdp_flags, __u32 target_prog_id)
 
 struct bpf_object *load_bpf_obj_file(const char *filename, int ifidx)
 {
-    int first_prog_fd = -1;
-    struct bpf_object *bpf_obj;
-    struct bpf_prog_load_attr prog_load_attr = {
-        .prog_type = BPF_PROG_TYPE_XDP,
-        .ifindex = ifidx,
-    };
-    prog_load_attr.file = filename;
-
     printf("bpf ifidx: %d\n", ifidx);
 
-    int err = bpf_prog_load_xattr(
-        &prog_load_attr,
-        &bpf_obj,
-        &first_prog_fd);
-    if (err < 0)
-    {
-        fprintf(stderr, "ERR: load XDP prog from obj file(%s) failed: err(%d): %s\n", filename, -err, strerror(-err));
-        return NULL;
-    }
-
-    return bpf_obj;
+    /* bpf_prog_load_xattr() cannot set up map-in-map templates */
+    return load_bpf_obj_file_rodata(filename, ifidx, NULL, NULL, 0, NULL);
 }
 
 struct bpf_object *open_bpf_obj(const char *filename, int ifidx)
@@ -155,6 +140,119 @@ struct bpf_object *open_bpf_obj(const char *filename, int ifidx)
     return obj;
 }
 
+/*
+ * Maps only a disabled feature reads are still created at load. Back
+ * them with a one entry array instead: it costs a page and loads on any
+ * kernel, whatever the real type or size would need. Maps reused from
+ * pins keep theirs.
+ */
+int stub_bpf_obj_maps(struct bpf_object *obj, const char *const *names)
+{
+    for (; names && *names; names++)
+    {
+        struct bpf_map *map = bpf_object__find_map_by_name(obj, *names);
+        if (!map || bpf_map__fd(map) >= 0)
+        {
+            continue;
+        }
+
+        __u32 value_size = bpf_map__def(map)->value_size;
+        int fd = bpf_create_map_name(BPF_MAP_TYPE_ARRAY, *names, sizeof(__u32), value_size ? value_size : sizeof(__u32), 1, 0);
+        if (fd < 0)
+        {
+            return -errno;
+        }
+
+        int err = bpf_map__reuse_fd(map, fd);
+        close(fd);
+        if (err)
+        {
+            return err;
+        }
+    }
+    return 0;
+}
+
+static bool is_map_in_map(const struct bpf_map *map)
+{
+    __u32 type = bpf_map__def(map)->type;
+    return type == BPF_MAP_TYPE_ARRAY_OF_MAPS || type == BPF_MAP_TYPE_HASH_OF_MAPS;
+}
+
+/*
+ * "<outer>_inner" only shapes its outer map at load. It is not pinned:
+ * once the outer slot is swapped for a resized table it would be stale.
+ */
+static bool is_inner_map_template(struct bpf_object *obj, const struct bpf_map *map)
+{
+    const char *name = bpf_map__name(map);
+    size_t len = strlen(name), suffix_len = strlen(INNER_MAP_SUFFIX);
+    if (len <= suffix_len || strcmp(name + len - suffix_len, INNER_MAP_SUFFIX))
+    {
+        return false;
+    }
+
+    char outer_name[PATH_MAX];
+    snprintf(outer_name, sizeof(outer_name), "%.*s", (int)(len - suffix_len), name);
+    struct bpf_map *outer = bpf_object__find_map_by_name(obj, outer_name);
+    return outer && is_map_in_map(outer);
+}
+
+/* bpf_object__pin_maps() minus the inner map templates */
+int pin_bpf_obj_maps(struct bpf_object *obj, const char *pin_dir)
+{
+    char buf[PATH_MAX];
+    struct bpf_map *map;
+    bpf_object__for_each_map(map, obj)
+    {
+        if (is_inner_map_template(obj, map))
+        {
+            continue;
+        }
+
+        int len = snprintf(buf, PATH_MAX, "%s/%s", pin_dir, bpf_map__name(map));
+        if (len < 0 || len >= PATH_MAX)
+        {
+            return -ENAMETOOLONG;
+        }
+
+        int err = bpf_map__pin(map, buf);
+        if (err)
+        {
+            return err;
+        }
+    }
+    return 0;
+}
+
+/* Also drops template pins left by older loaders, those may be missing */
+int unpin_bpf_obj_maps(struct bpf_object *obj, const char *pin_dir)
+{
+    char buf[PATH_MAX];
+    struct bpf_map *map;
+    bpf_object__for_each_map(map, obj)
+    {
+        int len = snprintf(buf, PATH_MAX, "%s/%s", pin_dir, bpf_map__name(map));
+        if (len < 0 || len >= PATH_MAX)
+        {
+            return -ENAMETOOLONG;
+        }
+
+        if (is_inner_map_template(obj, map))
+        {
+            unlink(buf);
+            continue;
+        }
+
+        int err = bpf_map__unpin(map, buf);
+        if (err)
+        {
+            return err;
+        }
+    }
+    return 0;
+}
+
 int reuse_maps(struct bpf_object *obj, const char *path)
 {
     if (!obj)
@@ -171,6 +269,12 @@ int reuse_maps(struct bpf_object *obj, const char *path)
     struct bpf_map *map;
     bpf_object__for_each_map(map, obj)
     {
+        /* Not pinned, load creates a fresh one that only serves as the layout */
+        if (is_inner_map_template(obj, map))
+        {
+            continue;
+        }
+
         int len = snprintf(buf, PATH_MAX, "%s/%s", path, bpf_map__name(map));
         if (len < 0)
         {
@@ -197,10 +301,180 @@ int reuse_maps(struct bpf_object *obj, const char *path)
     return 0;
 }
 
+/* Overwrite the const volatile globals before load, the verifier then sees them as constants */
+int set_bpf_obj_rodata(struct bpf_object *obj, const void *data, size_t size)
+{
+    struct bpf_map *map;
+    bpf_object__for_each_map(map, obj)
+    {
+        const char *name = bpf_map__name(map);
+        size_t len = strlen(name);
+        if (bpf_map__is_internal(map) && len >= 7 && !strcmp(name + len - 7, ".rodata"))
+        {
+            return bpf_map__set_initial_value(map, data, size);
+        }
+    }
+    return -ENOENT;
+}
+
+/* Read back the .rodata of the XDP prog attached to ifidx, e.g. to see which features it was built with */
+int xdp_prog_rodata(int ifidx, void *data, size_t size)
+{
+    __u32 prog_id = 0;
+    int err = bpf_get_link_xdp_id(ifidx, &prog_id, 0);
+    if (err < 0)
+    {
+        return err;
+    }
+    if (!prog_id)
+    {
+        return -ENOENT;
+    }
+
+    int prog_fd = bpf_prog_get_fd_by_id(prog_id);
+    if (prog_fd < 0)
+    {
+        return -errno;
+    }
+
+    __u32 map_ids[64];
+    struct bpf_prog_info info = {
+        .nr_map_ids = sizeof(map_ids) / sizeof(map_ids[0]),
+        .map_ids = (__u64)(unsigned long)map_ids,
+    };
+    __u32 info_len = sizeof(info);
+    err = bpf_obj_get_info_by_fd(prog_fd, &info, &info_len);
+    close(prog_fd);
+    if (err)
+    {
+        return -errno;
+    }
+
+    err = -ENOENT;
+    for (__u32 i = 0; i < info.nr_map_ids && i < sizeof(map_ids) / sizeof(map_ids[0]); i++)
+    {
+        int map_fd = bpf_map_get_fd_by_id(map_ids[i]);
+        if (map_fd < 0)
+        {
+            continue;
+        }
+
+        struct bpf_map_info map_info = {0};
+        __u32 map_info_len = sizeof(map_info);
+        size_t len = 0;
+        if (!bpf_obj_get_info_by_fd(map_fd, &map_info, &map_info_len))
+        {
+            len = strlen(map_info.name);
+        }
+        if (len >= 7 && !strcmp(map_info.name + len - 7, ".rodata") && map_info.value_size >= size)
+        {
+            char value[map_info.value_size];
+            __u32 key = 0;
+            err = bpf_map_lookup_elem(map_fd, &key, value) ? -errno : 0;
+            if (!err)
+            {
+                memcpy(data, value, size);
+            }
+        }
+        close(map_fd);
+        if (err != -ENOENT)
+        {
+            break;
+        }
+    }
+    return err;
+}
+
+static struct bpf_map *find_inner_map_template(struct bpf_object *obj, const struct bpf_map *outer)
+{
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s" INNER_MAP_SUFFIX, bpf_map__name(outer));
+    return bpf_object__find_map_by_name(obj, name);
+}
+
+/* Legacy map defs cannot describe an inner map, "<outer>_inner" serves as the template */
+int set_bpf_obj_inner_maps(struct bpf_object *obj)
+{
+    struct bpf_map *map;
+    bpf_object__for_each_map(map, obj)
+    {
+        if (!is_map_in_map(map))
+        {
+            continue;
+        }
+
+        struct bpf_map *tmpl = find_inner_map_template(obj, map);
+        if (!tmpl)
+        {
+            fprintf(stderr, "ERR: map(%s) has no %s" INNER_MAP_SUFFIX " template\n", bpf_map__name(map), bpf_map__name(map));
+            return -ENOENT;
+        }
+
+        const struct bpf_map_def *def = bpf_map__def(tmpl);
+        int fd = bpf_create_map_name(def->type, bpf_map__name(tmpl), def->key_size, def->value_size, def->max_entries, def->map_flags);
+        if (fd < 0)
+        {
+            int err = -errno;
+            fprintf(stderr, "ERR: create map(%s) failed(%d): %s\n", bpf_map__name(tmpl), -err, strerror(-err));
+            if (def->type == BPF_MAP_TYPE_BLOOM_FILTER)
+            {
+                fprintf(stderr, "ERR: bloom filter maps need kernel 5.16 or later, drop --bloom-fp on older ones\n");
+            }
+            return err;
+        }
+
+        int err = bpf_map__set_inner_map_fd(map, fd);
+        if (err)
+        {
+            close(fd);
+            return err;
+        }
+    }
+    return 0;
+}
+
+/* Seeds slot 0 of every empty outer map with its template, reused pinned maps keep their tables */
+int init_bpf_obj_inner_maps(struct bpf_object *obj)
+{
+    struct bpf_map *map;
+    bpf_object__for_each_map(map, obj)
+    {
+        if (!is_map_in_map(map))
+        {
+            continue;
+        }
+
+        struct bpf_map *tmpl = find_inner_map_template(obj, map);
+        int outer_fd = bpf_map__fd(map);
+        int inner_fd = tmpl ? bpf_map__fd(tmpl) : -1;
+        __u32 slot = 0, id;
+        if (inner_fd < 0 || !bpf_map_lookup_elem(outer_fd, &slot, &id))
+        {
+            continue;
+        }
+        if (bpf_map_update_elem(outer_fd, &slot, &inner_fd, BPF_ANY))
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
 struct bpf_object *load_bpf_obj_file_reuse_maps(
     const char *filename,
     int ifidx,
     const char *pin_dir)
+{
+    return load_bpf_obj_file_rodata(filename, ifidx, pin_dir, NULL, 0, NULL);
+}
+
+struct bpf_object *load_bpf_obj_file_rodata(
+    const char *filename,
+    int ifidx,
+    const char *pin_dir,
+    const void *rodata,
+    size_t rodata_sz,
+    const char *const *stub_maps)
 {
     struct bpf_object *obj = open_bpf_obj(filename, ifidx);
     if (!obj)
@@ -209,10 +483,39 @@ struct bpf_object *load_bpf_obj_file_reuse_maps(
         return NULL;
     }
 
-    int err = reuse_maps(obj, pin_dir);
+    int err;
+    if (pin_dir)
+    {
+        err = reuse_maps(obj, pin_dir);
+        if (err)
+        {
+            fprintf(stderr, "ERR: reuse map in file(%s) pin_dir(%s) failed(%d): %s\n", filename, pin_dir, err, strerror(-err));
+            return NULL;
+        }
+    }
+
+    if (rodata)
+    {
+        err = set_bpf_obj_rodata(obj, rodata, rodata_sz);
+        if (err)
+        {
+            fprintf(stderr, "ERR: set .rodata of file(%s) failed(%d): %s\n", filename, err, strerror(-err));
+            return NULL;
+        }
+    }
+
+    /* Before the templates are read, a stubbed one shapes its outer map */
+    err = stub_bpf_obj_maps(obj, stub_maps);
+    if (err)
+    {
+        fprintf(stderr, "ERR: stub unused maps of file(%s) failed(%d): %s\n", filename, err, strerror(-err));
+        return NULL;
+    }
+
+    err = set_bpf_obj_inner_maps(obj);
     if (err)
     {
-        fprintf(stderr, "ERR: reuse map in file(%s) pin_dir(%s) failed(%d): %s\n", filename, pin_dir, err, strerror(-err));
+        fprintf(stderr, "ERR: set inner maps of file(%s) failed(%d): %s\n", filename, err, strerror(-err));
         return NULL;
     }
 
@@ -223,6 +526,13 @@ struct bpf_object *load_bpf_obj_file_reuse_maps(
         return NULL;
     }
 
+    err = init_bpf_obj_inner_maps(obj);
+    if (err)
+    {
+        fprintf(stderr, "ERR: init inner maps of file(%s) failed(%d): %s\n", filename, err, strerror(-err));
+        return NULL;
+    }
+
     return obj;
 }
 
@@ -235,12 +545,15 @@ struct bpf_object *load_bpf_and_xdp_attach(struct config *cfg)
     }
 
     struct bpf_object *bpf_obj;
-    if (cfg->reuse_maps)
+    if (cfg->reuse_maps || cfg->rodata)
     {
-        bpf_obj = load_bpf_obj_file_reuse_maps(
+        bpf_obj = load_bpf_obj_file_rodata(
             cfg->obj_filename,
             offload_ifidx,
-            cfg->pin_dir);
+            cfg->reuse_maps ? cfg->pin_dir : NULL,
+            cfg->rodata,
+            cfg->rodata_sz,
+            cfg->stub_maps);
     }
     else
     {
@@ -288,6 +601,129 @@ struct bpf_object *load_bpf_and_xdp_attach(struct config *cfg)
     return bpf_obj;
 }
 
+int tc_link_attach(int ifidx, int prog_fd)
+{
+    DECLARE_LIBBPF_OPTS(bpf_tc_hook, hook, .ifindex = ifidx, .attach_point = BPF_TC_INGRESS);
+    DECLARE_LIBBPF_OPTS(bpf_tc_opts, opts,
+                        .handle = TC_ATTACH_HANDLE,
+                        .priority = TC_ATTACH_PRIO,
+                        .prog_fd = prog_fd,
+                        .flags = BPF_TC_F_REPLACE);
+
+    /* clsact may already be there with other users' filters on it */
+    int err = bpf_tc_hook_create(&hook);
+    if (err && err != -EEXIST)
+    {
+        fprintf(stderr, "ERR: ifidx(%d) create clsact failed(%d): %s\n", ifidx, -err, strerror(-err));
+        return EXIT_FAIL_BPF;
+    }
+
+    err = bpf_tc_attach(&hook, &opts);
+    if (err)
+    {
+        fprintf(stderr, "ERR: ifidx(%d) attach tc prog failed(%d): %s\n", ifidx, -err, strerror(-err));
+        return EXIT_FAIL_BPF;
+    }
+    return EXIT_OK;
+}
+
+int tc_link_detach(int ifidx)
+{
+    DECLARE_LIBBPF_OPTS(bpf_tc_hook, hook, .ifindex = ifidx, .attach_point = BPF_TC_INGRESS);
+    DECLARE_LIBBPF_OPTS(bpf_tc_opts, opts, .handle = TC_ATTACH_HANDLE, .priority = TC_ATTACH_PRIO);
+
+    int err = bpf_tc_detach(&hook, &opts);
+    if (err == -ENOENT || err == -EINVAL)
+    {
+        printf("INFO: %s() no TC prog on ifidx: %d\n", __func__, ifidx);
+        return EXIT_OK;
+    }
+    if (err)
+    {
+        fprintf(stderr, "ERR: %s() detach tc failed: err(%d) %s\n", __func__, -err, strerror(-err));
+        return EXIT_FAIL_BPF;
+    }
+
+    printf("INFO: %s() rm TC prog on ifidx: %d\n", __func__, ifidx);
+    return EXIT_OK;
+}
+
+struct bpf_object *load_bpf_and_tc_attach(struct config *cfg)
+{
+    struct bpf_object *bpf_obj;
+    int prog_fd = -1;
+
+    int err = bpf_prog_load(cfg->tc_filename, BPF_PROG_TYPE_SCHED_CLS, &bpf_obj, &prog_fd);
+    if (err < 0)
+    {
+        fprintf(stderr, "ERR: load TC prog from obj file(%s) failed: err(%d): %s\n", cfg->tc_filename, -err, strerror(-err));
+        return NULL;
+    }
+
+    if (tc_link_attach(cfg->netif_idx, prog_fd))
+    {
+        bpf_object__close(bpf_obj);
+        return NULL;
+    }
+    return bpf_obj;
+}
+
+/*
+ * Turns on run_time_ns/run_cnt accounting for all progs until the
+ * returned fd is closed. It costs a few ns per prog run, so only hold it
+ * while someone is looking.
+ */
+int enable_prog_run_stats(void)
+{
+    int fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+    if (fd < 0)
+    {
+        fprintf(stderr, "WARN: enable BPF run-time stats failed(%d): %s\n", errno, strerror(errno));
+    }
+    return fd;
+}
+
+int xdp_prog_run_stats(int ifidx, struct prog_run_stats *stats)
+{
+    __u32 prog_id = 0;
+    int err = bpf_get_link_xdp_id(ifidx, &prog_id, 0);
+    if (err < 0)
+    {
+        return err;
+    }
+
+    /* Prog replaced (or removed) since last call, e.g. after a deploy */
+    if (prog_id != stats->prog_id || stats->prog_fd < 0)
+    {
+        if (stats->prog_fd >= 0)
+        {
+            close(stats->prog_fd);
+        }
+        stats->prog_fd = prog_id ? bpf_prog_get_fd_by_id(prog_id) : -1;
+        /* Only a prog we hold counts as seen, a failed get is retried next call */
+        stats->prog_id = stats->prog_fd >= 0 ? prog_id : 0;
+        stats->run_time_ns = 0;
+        stats->run_cnt = 0;
+    }
+    if (stats->prog_fd < 0)
+    {
+        return -ENOENT;
+    }
+
+    struct bpf_prog_info info = {0};
+    __u32 info_len = sizeof(info);
+    err = bpf_obj_get_info_by_fd(stats->prog_fd, &info, &info_len);
+    if (err)
+    {
+        return err;
+    }
+
+    stats->ts = gettime();
+    stats->run_time_ns = info.run_time_ns;
+    stats->run_cnt = info.run_cnt;
+    return 0;
+}
+
 static const char *xdp_act_names[XDP_ACTION_MAX] = {
     [XDP_ABORTED] = "XDP_ABORTED",
     [XDP_DROP] = "XDP_DROP",
@@ -306,18 +742,35 @@ const char *action2str(__u32 act)
     return NULL;
 }
 
+__u64 gettime(void)
+{
+    struct timespec t;
+    int res = clock_gettime(CLOCK_MONOTONIC, &t);
+    if (res < 0)
+    {
+        fprintf(stderr, "ERR: get time failed(%d)\n", res);
+        exit(EXIT_FAIL);
+    }
+    return (__u64)t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
+}
+
 int open_bpf_map_file(const struct config *cfg, struct bpf_map_info *info)
+{
+    return open_bpf_map_file_by_name(cfg, cfg->mapname, info);
+}
+
+int open_bpf_map_file_by_name(const struct config *cfg, const char *mapname, struct bpf_map_info *info)
 {
     char filename[PATH_MAX];
 
-    int len = snprintf(filename, PATH_MAX, "%s/%s/%s", cfg->pin_basedir, cfg->netif_name, cfg->mapname);
+    int len = snprintf(filename, PATH_MAX, "%s/%s/%s", cfg->pin_basedir, cfg->netif_name, mapname);
     if (len < 0)
     {
         fprintf(stderr, "ERR: format map file name failed(%d): %s\n", len, strerror(-len));
         return -len;
     }
 
-    printf("INFO: map filename: %s\n", cfg->mapname);
+    printf("INFO: map filename: %s\n", mapname);
 
     int fd = bpf_obj_get(filename);
     if (fd < 0)
@@ -337,4 +790,47 @@ int open_bpf_map_file(const struct config *cfg, struct bpf_map_info *info)
         }
     }
     return fd;
-}
\ No newline at end of file
+}
+
+int check_map_fd_info(int map_fd, struct bpf_map_info *info, struct bpf_map_info *exp)
+{
+    __u32 info_len = sizeof(*info);
+
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL;
+    }
+
+    int err = bpf_obj_get_info_by_fd(map_fd, info, &info_len);
+    if (err)
+    {
+        fprintf(stderr, "ERR: %s() cant't get info: %s\n", __func__, strerror(-err));
+        return EXIT_FAIL_BPF;
+    }
+
+    if (exp->key_size && exp->key_size != info->key_size)
+    {
+        fprintf(stderr, "ERR: %s() Map key size mismatch, expect(%d), found(%d)\n", __func__, exp->key_size, info->key_size);
+        return EXIT_FAIL;
+    }
+
+    if (exp->value_size && exp->value_size != info->value_size)
+    {
+        fprintf(stderr, "ERR: %s() map value size mismatch, expect(%d), found(%d)\n", __func__, exp->value_size, info->value_size);
+        return EXIT_FAIL;
+    }
+
+    if (exp->max_entries && exp->max_entries != info->max_entries)
+    {
+        fprintf(stderr, "ERR: %s() map max entries mismatch, expect(%d), found(%d)\n", __func__, exp->max_entries, info->max_entries);
+        return EXIT_FAIL;
+    }
+
+    if (exp->type && exp->type != info->type)
+    {
+        fprintf(stderr, "ERR: %s() map type mismatch, expect(%u), found(%u)\n", __func__, exp->type, info->type);
+        return EXIT_FAIL;
+    }
+
+    return 0;
+}
@@ -11,9 +11,51 @@ int xdp_link_detach(int ifidx, __u32 xdp_flags, __u32 prog_id);
 
 struct bpf_object *load_bpf_obj_file(const char *filename, int ifidx);
 struct bpf_object *load_bpf_obj_file_reuse_maps(const char *filename, int ifidx, const char *pin_dir);
+struct bpf_object *load_bpf_obj_file_rodata(
+    const char *filename,
+    int ifidx,
+    const char *pin_dir,
+    const void *rodata,
+    size_t rodata_sz,
+    const char *const *stub_maps);
+int set_bpf_obj_rodata(struct bpf_object *obj, const void *data, size_t size);
+int stub_bpf_obj_maps(struct bpf_object *obj, const char *const *names);
+int xdp_prog_rodata(int ifidx, void *data, size_t size);
+
+/* Outer map "X" takes its inner map layout from "X_inner" in the same object */
+#define INNER_MAP_SUFFIX "_inner"
+
+int set_bpf_obj_inner_maps(struct bpf_object *obj);
+int init_bpf_obj_inner_maps(struct bpf_object *obj);
+int pin_bpf_obj_maps(struct bpf_object *obj, const char *pin_dir);
+int unpin_bpf_obj_maps(struct bpf_object *obj, const char *pin_dir);
 struct bpf_object *load_bpf_and_xdp_attach(struct config *cfg);
 
+/* TC ingress filter slot owned by the loader */
+#define TC_ATTACH_HANDLE 0x584d
+#define TC_ATTACH_PRIO 1
+
+int tc_link_attach(int ifidx, int prog_fd);
+int tc_link_detach(int ifidx);
+struct bpf_object *load_bpf_and_tc_attach(struct config *cfg);
+
+/* Kernel run-time accounting of the XDP prog attached to an interface */
+struct prog_run_stats
+{
+    __u32 prog_id;
+    int prog_fd;
+    __u64 ts;
+    __u64 run_time_ns;
+    __u64 run_cnt;
+};
+
+int enable_prog_run_stats(void);
+int xdp_prog_run_stats(int ifidx, struct prog_run_stats *stats);
+
 const char *action2str(__u32 act);
+__u64 gettime(void);
 int open_bpf_map_file(const struct config *cfg, struct bpf_map_info *info);
+int open_bpf_map_file_by_name(const struct config *cfg, const char *mapname, struct bpf_map_info *info);
+int check_map_fd_info(int map_fd, struct bpf_map_info *info, struct bpf_map_info *exp);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#!/usr/bin/env bash
+#
+# Compare the denylist miss path with and without the bloom prefilter.
+# Builds a denylist of ENTRIES random addresses and a capture of FRAMES
+# UDP frames from other random sources, so nearly every lookup misses,
+# then replays it through pcap_replay with --filter alone and with
+# --bloom-fp. Reports the kernel ns/pkt of each run and the filter
+# counters, BLOOM_FP should stay near FP_RATE of the frames.
+#
+# Needs root and python3. Build with make first.
+
+set -e
+
+ENTRIES=${ENTRIES:-1000000}
+FRAMES=${FRAMES:-200000}
+FP_RATE=${FP_RATE:-0.01}
+THREADS=${THREADS:-1}
+REPEAT=${REPEAT:-10}
+WORKDIR=$(mktemp -d)
+
+cd "$(dirname "$0")"
+
+cleanup() {
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+python3 - "$ENTRIES" "$FRAMES" "$WORKDIR" <<'PY'
+import random, socket, struct, sys
+
+entries, frames, workdir = int(sys.argv[1]), int(sys.argv[2]), sys.argv[3]
+rnd = random.Random(1)
+
+deny = set()
+while len(deny) < entries:
+    deny.add(rnd.getrandbits(32))
+with open(f"{workdir}/deny.txt", "w") as f:
+    for addr in deny:
+        f.write(socket.inet_ntoa(struct.pack("!I", addr)) + "\n")
+
+def csum(hdr):
+    s = sum(struct.unpack("!10H", hdr))
+    s = (s >> 16) + (s & 0xffff)
+    return ~(s + (s >> 16)) & 0xffff
+
+with open(f"{workdir}/miss.pcap", "wb") as f:
+    f.write(struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1))
+    eth = b"\x02\x00\x00\x00\x00\x01\x02\x00\x00\x00\x00\x02\x08\x00"
+    payload = bytes(18)
+    for i in range(frames):
+        src = rnd.getrandbits(32)
+        while src in deny:
+            src = rnd.getrandbits(32)
+        ip = struct.pack("!BBHHHBBH4s4s", 0x45, 0, 20 + 8 + len(payload), i & 0xffff, 0,
+                         64, 17, 0, struct.pack("!I", src), socket.inet_aton("10.0.0.1"))
+        ip = ip[:10] + struct.pack("!H", csum(ip)) + ip[12:]
+        udp = struct.pack("!HHHH", 1024 + i % 1000, 53, 8 + len(payload), 0)
+        frame = eth + ip + udp + payload
+        f.write(struct.pack("<IIII", i, 0, len(frame), len(frame)) + frame)
+PY
+
+run() {
+    local label=$1
+    shift
+    echo "== $label"
+    ./pcap_replay --pcap "$WORKDIR/miss.pcap" --filter "$WORKDIR/deny.txt" \
+        --threads "$THREADS" --repeat "$REPEAT" "$@" |
+        grep -E '^(prog|wall|FILTER_|BLOOM_)'
+}
+
+run "hash only"
+run "bloom fp $FP_RATE" --bloom-fp "$FP_RATE"
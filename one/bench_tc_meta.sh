@@ -0,0 +1,62 @@
+#!/usr/bin/env bash
+#
+# Compare tc_classify_prog cost with and without the XDP metadata handoff.
+# Runs UDP traffic into a veth pair and reads run_time_ns/run_cnt of the TC
+# prog via kernel BPF stats, once with xdp_stat_prog in front and once
+# with TC alone (falls back to parsing the headers itself).
+#
+# Needs root, iperf3 and bpftool. Build with make first.
+
+set -e
+
+DEV=${DEV:-xdpbench0}
+PEER=${PEER:-xdpbench1}
+NS=${NS:-xdpbench}
+DURATION=${DURATION:-10}
+
+cd "$(dirname "$0")"
+
+cleanup() {
+    ./main --dev "$DEV" --unload >/dev/null 2>&1 || true
+    ip netns del "$NS" 2>/dev/null || true
+    ip link del "$DEV" 2>/dev/null || true
+    pkill -f "iperf3 -s -B 10.11.0.1" 2>/dev/null || true
+}
+trap cleanup EXIT
+
+ip link add "$DEV" type veth peer name "$PEER"
+ip netns add "$NS"
+ip link set "$PEER" netns "$NS"
+ip addr add 10.11.0.1/24 dev "$DEV"
+ip link set "$DEV" up
+ip -n "$NS" addr add 10.11.0.2/24 dev "$PEER"
+ip -n "$NS" link set "$PEER" up
+
+sysctl -qw kernel.bpf_stats_enabled=1
+iperf3 -s -B 10.11.0.1 -D
+
+tc_prog_cost() {
+    local id
+    id=$(bpftool prog show name tc_classify_prog -j | sed -n 's/.*"id":\([0-9]*\).*/\1/p' | head -1)
+    bpftool prog show id "$id" | sed -n 's/.*run_time_ns \([0-9]*\) run_cnt \([0-9]*\).*/\1 \2/p'
+}
+
+run() {
+    local label=$1
+    local before after
+    before=$(tc_prog_cost)
+    ip netns exec "$NS" iperf3 -c 10.11.0.1 -u -b 0 -l 64 -t "$DURATION" >/dev/null
+    after=$(tc_prog_cost)
+    set -- $before $after
+    local ns=$(($3 - $1)) cnt=$(($4 - $2))
+    [ "$cnt" -gt 0 ] || { echo "$label: no packets seen"; return; }
+    echo "$label: $cnt pkts, $((ns / cnt)) ns/pkt in tc_classify_prog"
+}
+
+./main --dev "$DEV" --skb-mode --pinmap
+run "xdp+tc (metadata)"
+
+ip link set dev "$DEV" xdpgeneric off
+run "tc only (reparse)"
+
+sysctl -qw kernel.bpf_stats_enabled=0
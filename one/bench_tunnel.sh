@@ -0,0 +1,93 @@
+#!/usr/bin/env bash
+#
+# Compare VXLAN receive: kernel vxlan device vs XDP decap.
+# A netns sends UDP over VXLAN across a veth pair. xdp_stat_prog is
+# attached to DEV in both runs, once passing the outer frame on to the
+# host's vxlan device and once with --tunnels stripping the outer headers
+# and passing the inner frame up DEV directly. Reports delivered pps and
+# run_time_ns/run_cnt of xdp_stat_prog from kernel BPF stats, so the
+# difference is what decap costs in XDP; the vxlan device's own cost
+# shows up only as pps.
+#
+# Needs root, iperf3 and bpftool. Build with make first.
+
+set -e
+
+DEV=${DEV:-tunbench0}
+PEER=${PEER:-tunbench1}
+NS=${NS:-tunbench}
+DURATION=${DURATION:-10}
+TUN_CONF=$(mktemp)
+
+cd "$(dirname "$0")"
+
+cleanup() {
+    ./main --dev "$DEV" --unload >/dev/null 2>&1 || true
+    ip netns del "$NS" 2>/dev/null || true
+    ip link del vx0 2>/dev/null || true
+    ip link del "$DEV" 2>/dev/null || true
+    pkill -f "iperf3 -s -B 10.12.0.1" 2>/dev/null || true
+    sysctl -qw kernel.bpf_stats_enabled=0
+    rm -f "$TUN_CONF"
+}
+trap cleanup EXIT
+
+# Underlay 10.11.0.0/24, overlay 10.12.0.0/24 on VNI 100
+ip link add "$DEV" type veth peer name "$PEER"
+ip netns add "$NS"
+ip link set "$PEER" netns "$NS"
+ip addr add 10.11.0.1/24 dev "$DEV"
+ip link set "$DEV" up
+ip -n "$NS" addr add 10.11.0.2/24 dev "$PEER"
+ip -n "$NS" link set "$PEER" up
+
+ip link add vx0 type vxlan id 100 local 10.11.0.1 remote 10.11.0.2 dstport 4789 dev "$DEV"
+ip addr add 10.12.0.1/24 dev vx0
+ip link set vx0 up
+ip -n "$NS" link add vx0 type vxlan id 100 local 10.11.0.2 remote 10.11.0.1 dstport 4789 dev "$PEER"
+ip -n "$NS" addr add 10.12.0.2/24 dev vx0
+ip -n "$NS" link set vx0 up
+
+# Decapped frames enter on DEV while the route back to 10.12.0.2 is vx0
+sysctl -qw net.ipv4.conf."$DEV".rp_filter=2
+
+# Resolve the overlay neighbour in the netns while vx0 still sees the
+# ARP traffic. Replies always leave through the host vxlan device, pin
+# its neighbour since decapped ARP replies would land on DEV instead.
+ip netns exec "$NS" ping -c 1 -W 1 10.12.0.1 >/dev/null
+NS_VX_MAC=$(ip -n "$NS" -br link show vx0 | awk '{print $3}')
+ip neigh replace 10.12.0.2 lladdr "$NS_VX_MAC" dev vx0
+
+sysctl -qw kernel.bpf_stats_enabled=1
+iperf3 -s -B 10.12.0.1 -D
+
+xdp_prog_cost() {
+    local id
+    id=$(bpftool prog show name xdp_stat_prog -j | sed -n 's/.*"id":\([0-9]*\).*/\1/p' | head -1)
+    bpftool prog show id "$id" | sed -n 's/.*run_time_ns \([0-9]*\) run_cnt \([0-9]*\).*/\1 \2/p'
+}
+
+run() {
+    local label=$1
+    local before after out pps
+    before=$(xdp_prog_cost)
+    out=$(ip netns exec "$NS" iperf3 -c 10.12.0.1 -u -b 0 -l 64 -t "$DURATION")
+    after=$(xdp_prog_cost)
+
+    # receiver line carries lost/total datagrams
+    pps=$(echo "$out" | awk -v d="$DURATION" '/receiver/ {for (i = 1; i <= NF; i++) if ($i ~ /^[0-9]+\/[0-9]+$/) {split($i, b, "/"); print int((b[2] - b[1]) / d)}}')
+    [ -n "$pps" ] && [ "$pps" -gt 0 ] || { echo "$label: no packets delivered"; return; }
+
+    set -- $before $after
+    local ns=$(($3 - $1)) cnt=$(($4 - $2))
+    [ "$cnt" -gt 0 ] || { echo "$label: $pps pps delivered, no XDP runs seen"; return; }
+    echo "$label: $pps pps delivered, $((ns / cnt)) ns/pkt in xdp_stat_prog"
+}
+
+./main --dev "$DEV" --pinmap
+run "kernel vxlan device"
+./main --dev "$DEV" --unload
+
+echo "vxlan 10.11.0.1 100" > "$TUN_CONF"
+./main --dev "$DEV" --pinmap --tunnels "$TUN_CONF"
+run "xdp decap"
@@ -0,0 +1,734 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "../global/common_define.h"
+#include "../global/xdp_helper.h"
+#include "classifier_user.h"
+
+/* Both table sets share the tries, so each set gets half */
+#define CLS_SET_PORT_PREFIXES (CLS_PORT_PREFIXES / 2)
+
+struct cls_rule
+{
+    __u32 action;
+    __u32 src;
+    __u32 dst;
+    __u8 src_len;
+    __u8 dst_len;
+    __u8 flags;
+    __u8 flags_mask;
+    int proto;
+    __u16 sport_lo;
+    __u16 sport_hi;
+    __u16 dport_lo;
+    __u16 dport_hi;
+};
+
+struct cls_prefix
+{
+    __u32 addr;
+    __u8 len;
+};
+
+static const char *cls_flag_names[] = {"fin", "syn", "rst", "psh", "ack", "urg", "ece", "cwr"};
+
+static inline void bitmap_set(struct cls_bitmap *bm, __u32 bit)
+{
+    bm->w[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static inline __u32 prefix_mask(__u8 len, __u8 width)
+{
+    return len ? (__u32)(~0ULL << (width - len)) & (__u32)(~0ULL >> (64 - width)) : 0;
+}
+
+static int parse_action(const char *str, __u32 *action)
+{
+    static const struct
+    {
+        const char *name;
+        __u32 action;
+    } actions[] = {
+        {"pass", XDP_PASS},
+        {"drop", XDP_DROP},
+        {"tx", XDP_TX},
+        {"aborted", XDP_ABORTED},
+    };
+
+    for (__u32 i = 0; i < sizeof(actions) / sizeof(actions[0]); i++)
+    {
+        if (!strcmp(str, actions[i].name))
+        {
+            *action = actions[i].action;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+static int parse_cidr(char *str, __u32 *addr, __u8 *len)
+{
+    struct in_addr in;
+    char *slash = strchr(str, '/');
+    unsigned long plen = 32;
+
+    if (slash)
+    {
+        *slash = '\0';
+        char *end;
+        plen = strtoul(slash + 1, &end, 10);
+        if (*end || plen > 32)
+        {
+            return -EINVAL;
+        }
+    }
+    if (inet_pton(AF_INET, str, &in) != 1)
+    {
+        return -EINVAL;
+    }
+    *len = plen;
+    *addr = ntohl(in.s_addr) & prefix_mask(plen, 32);
+    return 0;
+}
+
+static int parse_port_range(const char *str, __u16 *lo, __u16 *hi)
+{
+    char *end;
+    unsigned long from = strtoul(str, &end, 10), to = from;
+
+    if (*end == '-')
+    {
+        to = strtoul(end + 1, &end, 10);
+    }
+    if (*end || from > to || to > 65535)
+    {
+        return -EINVAL;
+    }
+    *lo = from;
+    *hi = to;
+    return 0;
+}
+
+static int parse_proto(const char *str, int *proto)
+{
+    if (!strcmp(str, "tcp"))
+    {
+        *proto = IPPROTO_TCP;
+        return 0;
+    }
+    if (!strcmp(str, "udp"))
+    {
+        *proto = IPPROTO_UDP;
+        return 0;
+    }
+    if (!strcmp(str, "icmp"))
+    {
+        *proto = IPPROTO_ICMP;
+        return 0;
+    }
+
+    char *end;
+    unsigned long num = strtoul(str, &end, 10);
+    if (*end || num > 255)
+    {
+        return -EINVAL;
+    }
+    *proto = num;
+    return 0;
+}
+
+static int parse_flag_list(char *str, __u8 *flags)
+{
+    char *save, *name;
+
+    *flags = 0;
+    for (name = strtok_r(str, "+", &save); name; name = strtok_r(NULL, "+", &save))
+    {
+        __u32 bit;
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (!strcmp(name, cls_flag_names[bit]))
+            {
+                break;
+            }
+        }
+        if (bit == 8)
+        {
+            return -EINVAL;
+        }
+        *flags |= 1 << bit;
+    }
+    return 0;
+}
+
+static int parse_tcp_flags(char *str, __u8 *flags, __u8 *mask)
+{
+    char *slash = strchr(str, '/');
+    if (slash)
+    {
+        *slash = '\0';
+    }
+
+    int err = parse_flag_list(str, flags);
+    if (err)
+    {
+        return err;
+    }
+    if (!slash)
+    {
+        *mask = *flags;
+        return 0;
+    }
+
+    err = parse_flag_list(slash + 1, mask);
+    if (err || (*flags & ~*mask))
+    {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int parse_rule(char *line, struct cls_rule *rule)
+{
+    char *save;
+    char *tok = strtok_r(line, " \t\n", &save);
+
+    memset(rule, 0, sizeof(*rule));
+    rule->proto = -1;
+    rule->sport_hi = 65535;
+    rule->dport_hi = 65535;
+
+    int err = parse_action(tok, &rule->action);
+    while (!err && (tok = strtok_r(NULL, " \t\n", &save)))
+    {
+        char *val = strtok_r(NULL, " \t\n", &save);
+        if (!val)
+        {
+            return -EINVAL;
+        }
+
+        if (!strcmp(tok, "src"))
+        {
+            err = parse_cidr(val, &rule->src, &rule->src_len);
+        }
+        else if (!strcmp(tok, "dst"))
+        {
+            err = parse_cidr(val, &rule->dst, &rule->dst_len);
+        }
+        else if (!strcmp(tok, "proto"))
+        {
+            err = parse_proto(val, &rule->proto);
+        }
+        else if (!strcmp(tok, "sport"))
+        {
+            err = parse_port_range(val, &rule->sport_lo, &rule->sport_hi);
+        }
+        else if (!strcmp(tok, "dport"))
+        {
+            err = parse_port_range(val, &rule->dport_lo, &rule->dport_hi);
+        }
+        else if (!strcmp(tok, "flags"))
+        {
+            err = parse_tcp_flags(val, &rule->flags, &rule->flags_mask);
+        }
+        else
+        {
+            err = -EINVAL;
+        }
+    }
+    return err;
+}
+
+/* Returns the number of rules parsed or a negative errno */
+static int read_rules(const char *filename, struct cls_rule *rules)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: open rules file(%s) failed(%d): %s\n", filename, err, strerror(err));
+        return -err;
+    }
+
+    int nr = 0, lineno = 0, err = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+        if (strspn(line, " \t\n") == strlen(line))
+        {
+            continue;
+        }
+
+        if (nr >= CLS_MAX_RULES)
+        {
+            err = -E2BIG;
+        }
+        else
+        {
+            err = parse_rule(line, &rules[nr++]);
+        }
+        if (err)
+        {
+            fprintf(stderr, "ERR: rules file(%s) line %d invalid(%d): %s\n", filename, lineno, -err, strerror(-err));
+            break;
+        }
+    }
+    fclose(fp);
+    return err ? err : nr;
+}
+
+static __u32 add_prefix(struct cls_prefix *prefixes, __u32 nr, __u32 addr, __u8 len)
+{
+    for (__u32 i = 0; i < nr; i++)
+    {
+        if (prefixes[i].addr == addr && prefixes[i].len == len)
+        {
+            return nr;
+        }
+    }
+    prefixes[nr].addr = addr;
+    prefixes[nr].len = len;
+    return nr + 1;
+}
+
+/*
+ * LPM returns the longest stored prefix only, so every prefix carries the
+ * rules of all prefixes covering it as well.
+ */
+static int write_addr_field(int map_fd, __u8 set, const struct cls_rule *rules, __u32 nr_rules, bool dst)
+{
+    struct cls_prefix prefixes[CLS_MAX_RULES];
+    __u32 nr = 0;
+
+    for (__u32 i = 0; i < nr_rules; i++)
+    {
+        nr = add_prefix(prefixes, nr, dst ? rules[i].dst : rules[i].src, dst ? rules[i].dst_len : rules[i].src_len);
+    }
+
+    for (__u32 p = 0; p < nr; p++)
+    {
+        struct cls_bitmap bm = {0};
+        for (__u32 i = 0; i < nr_rules; i++)
+        {
+            __u32 addr = dst ? rules[i].dst : rules[i].src;
+            __u8 len = dst ? rules[i].dst_len : rules[i].src_len;
+            if (len <= prefixes[p].len && !((prefixes[p].addr ^ addr) & prefix_mask(len, 32)))
+            {
+                bitmap_set(&bm, i);
+            }
+        }
+
+        struct cls_addr_key key = {
+            .prefixlen = 8 + prefixes[p].len,
+            .set = set,
+            .addr = htonl(prefixes[p].addr),
+        };
+        if (bpf_map_update_elem(map_fd, &key, &bm, BPF_ANY))
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+/* Splits [lo, hi] into the aligned blocks a port trie can hold */
+static __u32 range_to_prefixes(__u32 lo, __u32 hi, struct cls_prefix *out, __u32 nr, __u8 *seen)
+{
+    while (lo <= hi)
+    {
+        __u32 size = lo ? lo & -lo : 0x10000;
+        while (lo + size - 1 > hi)
+        {
+            size >>= 1;
+        }
+
+        __u8 len = 16 - __builtin_ctz(size);
+        __u32 node = (1U << len) + (lo >> (16 - len));
+        if (!seen[node])
+        {
+            seen[node] = 1;
+            out[nr].addr = lo;
+            out[nr].len = len;
+            nr++;
+        }
+        lo += size;
+    }
+    return nr;
+}
+
+static int write_port_field(int map_fd, __u8 set, const struct cls_rule *rules, __u32 nr_rules, bool dport)
+{
+    /* A range splits into at most 30 blocks, bounded by the trie size below */
+    struct cls_prefix *prefixes = calloc(nr_rules * 30 + 1, sizeof(*prefixes));
+    __u8 *seen = calloc(1 << 17, 1);
+    __u32 nr = 0;
+    int err = 0;
+
+    if (!prefixes || !seen)
+    {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    for (__u32 i = 0; i < nr_rules; i++)
+    {
+        __u16 lo = dport ? rules[i].dport_lo : rules[i].sport_lo;
+        __u16 hi = dport ? rules[i].dport_hi : rules[i].sport_hi;
+        nr = range_to_prefixes(lo, hi, prefixes, nr, seen);
+    }
+    if (nr > CLS_SET_PORT_PREFIXES)
+    {
+        fprintf(stderr, "ERR: %s ranges need %u prefixes, max %u\n", dport ? "dport" : "sport", nr, CLS_SET_PORT_PREFIXES);
+        err = -E2BIG;
+        goto out;
+    }
+
+    for (__u32 p = 0; p < nr; p++)
+    {
+        __u32 first = prefixes[p].addr;
+        __u32 last = first + (1U << (16 - prefixes[p].len)) - 1;
+        struct cls_bitmap bm = {0};
+        for (__u32 i = 0; i < nr_rules; i++)
+        {
+            __u16 lo = dport ? rules[i].dport_lo : rules[i].sport_lo;
+            __u16 hi = dport ? rules[i].dport_hi : rules[i].sport_hi;
+            if (lo <= first && last <= hi)
+            {
+                bitmap_set(&bm, i);
+            }
+        }
+
+        struct cls_port_key key = {
+            .prefixlen = 8 + prefixes[p].len,
+            .set = set,
+            .port = htons(first),
+        };
+        if (bpf_map_update_elem(map_fd, &key, &bm, BPF_ANY))
+        {
+            err = -errno;
+            goto out;
+        }
+    }
+
+out:
+    free(prefixes);
+    free(seen);
+    return err;
+}
+
+static int write_proto_field(int map_fd, __u8 set, const struct cls_rule *rules, __u32 nr_rules)
+{
+    for (__u32 val = 0; val < 256; val++)
+    {
+        struct cls_bitmap bm = {0};
+        for (__u32 i = 0; i < nr_rules; i++)
+        {
+            if (rules[i].proto < 0 || rules[i].proto == (int)val)
+            {
+                bitmap_set(&bm, i);
+            }
+        }
+
+        __u32 key = CLS_ARRAY_KEY(set, val);
+        if (bpf_map_update_elem(map_fd, &key, &bm, BPF_ANY))
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+static int write_flags_field(int map_fd, __u8 set, const struct cls_rule *rules, __u32 nr_rules)
+{
+    for (__u32 val = 0; val < 256; val++)
+    {
+        struct cls_bitmap bm = {0};
+        for (__u32 i = 0; i < nr_rules; i++)
+        {
+            if ((val & rules[i].flags_mask) == rules[i].flags)
+            {
+                bitmap_set(&bm, i);
+            }
+        }
+
+        __u32 key = CLS_ARRAY_KEY(set, val);
+        if (bpf_map_update_elem(map_fd, &key, &bm, BPF_ANY))
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+/* Empties one set of a trie, the live set is never touched */
+static int clear_trie_set(int map_fd, __u8 set, __u32 key_size, __u32 max_entries)
+{
+    __u8 *keys = calloc(max_entries, key_size);
+    __u32 nr = 0;
+
+    if (!keys)
+    {
+        return -ENOMEM;
+    }
+    /* Collect first, deleting under get_next_key restarts the walk */
+    while (nr < max_entries &&
+           !bpf_map_get_next_key(map_fd, nr ? &keys[(nr - 1) * key_size] : NULL, &keys[nr * key_size]))
+    {
+        nr++;
+    }
+
+    int err = 0;
+    for (__u32 i = 0; i < nr && !err; i++)
+    {
+        /* set follows prefixlen in both key layouts */
+        __u8 *key = &keys[i * key_size];
+        if (key[sizeof(__u32)] == set && bpf_map_delete_elem(map_fd, key))
+        {
+            err = -errno;
+        }
+    }
+    free(keys);
+    return err;
+}
+
+static int reset_rule_stats(int map_fd, __u8 set)
+{
+    int nr_cpus = libbpf_num_possible_cpus();
+    struct datarec values[nr_cpus];
+
+    memset(values, 0, sizeof(values));
+    for (__u32 key = set * CLS_MAX_RULES; key < (set + 1) * CLS_MAX_RULES; key++)
+    {
+        if (bpf_map_update_elem(map_fd, &key, values, BPF_ANY))
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+struct cls_maps
+{
+    int ctl;
+    int src;
+    int dst;
+    int sport;
+    int dport;
+    int proto;
+    int flags;
+    int action;
+    int stat;
+};
+
+/* Pinned maps without obj, else the maps of an unpinned object */
+static int cls_map_fd(const struct config *cfg, struct bpf_object *obj, const char *name)
+{
+    return obj ? bpf_object__find_map_fd_by_name(obj, name) : open_bpf_map_file_by_name(cfg, name, NULL);
+}
+
+static int open_cls_maps(const struct config *cfg, struct bpf_object *obj, struct cls_maps *maps)
+{
+    maps->ctl = cls_map_fd(cfg, obj, "cls_ctl_map");
+    maps->src = cls_map_fd(cfg, obj, "cls_src_map");
+    maps->dst = cls_map_fd(cfg, obj, "cls_dst_map");
+    maps->sport = cls_map_fd(cfg, obj, "cls_sport_map");
+    maps->dport = cls_map_fd(cfg, obj, "cls_dport_map");
+    maps->proto = cls_map_fd(cfg, obj, "cls_proto_map");
+    maps->flags = cls_map_fd(cfg, obj, "cls_flags_map");
+    maps->action = cls_map_fd(cfg, obj, "cls_action_map");
+    maps->stat = cls_map_fd(cfg, obj, "cls_rule_stat_map");
+
+    if (maps->ctl < 0 || maps->src < 0 || maps->dst < 0 || maps->sport < 0 || maps->dport < 0 ||
+        maps->proto < 0 || maps->flags < 0 || maps->action < 0 || maps->stat < 0)
+    {
+        return EXIT_FAIL_BPF;
+    }
+    return EXIT_OK;
+}
+
+static int compile_rules(struct cls_maps *maps, __u8 set, const struct cls_rule *rules, __u32 nr)
+{
+    int err;
+
+    if ((err = clear_trie_set(maps->src, set, sizeof(struct cls_addr_key), CLS_ADDR_PREFIXES)) ||
+        (err = clear_trie_set(maps->dst, set, sizeof(struct cls_addr_key), CLS_ADDR_PREFIXES)) ||
+        (err = clear_trie_set(maps->sport, set, sizeof(struct cls_port_key), CLS_PORT_PREFIXES)) ||
+        (err = clear_trie_set(maps->dport, set, sizeof(struct cls_port_key), CLS_PORT_PREFIXES)))
+    {
+        return err;
+    }
+
+    if ((err = write_addr_field(maps->src, set, rules, nr, false)) ||
+        (err = write_addr_field(maps->dst, set, rules, nr, true)) ||
+        (err = write_port_field(maps->sport, set, rules, nr, false)) ||
+        (err = write_port_field(maps->dport, set, rules, nr, true)) ||
+        (err = write_proto_field(maps->proto, set, rules, nr)) ||
+        (err = write_flags_field(maps->flags, set, rules, nr)))
+    {
+        return err;
+    }
+
+    for (__u32 i = 0; i < nr; i++)
+    {
+        __u32 key = set * CLS_MAX_RULES + i;
+        if (bpf_map_update_elem(maps->action, &key, &rules[i].action, BPF_ANY))
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Compiles the rules into the set XDP is not reading, then flips
+ * cls_ctl.active. A packet sees either the old or the new rule list.
+ */
+static int classifier_load(const struct config *cfg, struct bpf_object *obj, const char *filename)
+{
+    struct cls_rule *rules = calloc(CLS_MAX_RULES, sizeof(*rules));
+    if (!rules)
+    {
+        return EXIT_FAIL;
+    }
+
+    int nr = read_rules(filename, rules);
+    if (nr < 0)
+    {
+        free(rules);
+        return EXIT_FAIL;
+    }
+
+    struct cls_maps maps;
+    if (open_cls_maps(cfg, obj, &maps))
+    {
+        free(rules);
+        return EXIT_FAIL_BPF;
+    }
+
+    __u32 zero = 0;
+    struct cls_ctl ctl = {0};
+    bpf_map_lookup_elem(maps.ctl, &zero, &ctl);
+    __u8 set = !(ctl.active & 1);
+
+    /* The inactive set's counters still hold the list before last */
+    int err = reset_rule_stats(maps.stat, set);
+    if (!err)
+    {
+        err = compile_rules(&maps, set, rules, nr);
+    }
+    free(rules);
+
+    if (err)
+    {
+        fprintf(stderr, "ERR: compile rules file(%s) failed(%d): %s\n", filename, -err, strerror(-err));
+        return EXIT_FAIL_BPF;
+    }
+
+    ctl.active = set;
+    ctl.nr_rules = nr;
+    if (bpf_map_update_elem(maps.ctl, &zero, &ctl, BPF_ANY))
+    {
+        fprintf(stderr, "ERR: switch classifier tables failed\n");
+        return EXIT_FAIL_BPF;
+    }
+
+    printf("INFO: rules file(%s) loaded %d rules into set %u\n", filename, nr, set);
+    return EXIT_OK;
+}
+
+int classifier_load_file(const struct config *cfg)
+{
+    return classifier_load(cfg, NULL, cfg->rules_file);
+}
+
+int classifier_load_obj(struct bpf_object *obj, const char *filename)
+{
+    return classifier_load(NULL, obj, filename);
+}
+
+int classifier_stats_open(const struct config *cfg, struct classifier_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->ctl_fd = open_bpf_map_file_by_name(cfg, "cls_ctl_map", NULL);
+    stats->action_fd = open_bpf_map_file_by_name(cfg, "cls_action_map", NULL);
+    stats->stat_fd = open_bpf_map_file_by_name(cfg, "cls_rule_stat_map", NULL);
+    stats->nr_cpus = libbpf_num_possible_cpus();
+    if (stats->ctl_fd < 0 || stats->action_fd < 0 || stats->stat_fd < 0 || stats->nr_cpus <= 0)
+    {
+        return EXIT_FAIL_BPF;
+    }
+    return EXIT_OK;
+}
+
+void classifier_stats_collect(struct classifier_stats *stats)
+{
+    struct datarec values[stats->nr_cpus];
+    __u32 zero = 0;
+    struct cls_ctl ctl = {0};
+
+    bpf_map_lookup_elem(stats->ctl_fd, &zero, &ctl);
+    stats->ts = gettime();
+    stats->set = ctl.active & 1;
+    stats->nr_rules = ctl.nr_rules < CLS_MAX_RULES ? ctl.nr_rules : CLS_MAX_RULES;
+    for (__u32 i = 0; i < stats->nr_rules; i++)
+    {
+        struct datarec *rec = &stats->rule[i];
+        __u32 key = stats->set * CLS_MAX_RULES + i;
+        memset(rec, 0, sizeof(*rec));
+        if (bpf_map_lookup_elem(stats->stat_fd, &key, values))
+        {
+            continue;
+        }
+        for (int cpu = 0; cpu < stats->nr_cpus; cpu++)
+        {
+            rec->rx_pkts += values[cpu].rx_pkts;
+            rec->rx_bytes += values[cpu].rx_bytes;
+        }
+    }
+}
+
+/* A reload moves the counters to the other set, which starts from zero */
+static __u64 counter_delta(__u64 curr, __u64 prev, bool same_set)
+{
+    return same_set && curr >= prev ? curr - prev : curr;
+}
+
+void classifier_stats_print(struct classifier_stats *stats, struct classifier_stats *prev)
+{
+    double period = (double)(stats->ts - prev->ts) / NANOSEC_PER_SEC;
+    if (period <= 0)
+    {
+        return;
+    }
+
+    bool same_set = stats->set == prev->set;
+    char label[64];
+    for (__u32 i = 0; i < stats->nr_rules; i++)
+    {
+        __u64 pkts = counter_delta(stats->rule[i].rx_pkts, prev->rule[i].rx_pkts, same_set);
+        __u64 bytes = counter_delta(stats->rule[i].rx_bytes, prev->rule[i].rx_bytes, same_set);
+        if (!pkts)
+        {
+            continue;
+        }
+
+        __u32 action = XDP_PASS;
+        __u32 key = stats->set * CLS_MAX_RULES + i;
+        bpf_map_lookup_elem(stats->action_fd, &key, &action);
+        snprintf(label, sizeof(label), "rule %u %s", i, action2str(action));
+        printf("%-28s %lld pkts (%'10.0f pps) %'11.2f Mbit/s\n",
+               label, pkts, pkts / period, (double)bytes * 8 / period / 1000000);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __ONE_CLASSIFIER_USER_H
+#define __ONE_CLASSIFIER_USER_H
+
+#include <linux/types.h>
+#include <bpf/libbpf.h>
+
+#include "../global/common_define.h"
+#include "common_user_kern.h"
+
+/*
+ * --rules file format, one rule per line in priority order, '#' starts a
+ * comment. Fields left out match anything:
+ *
+ *   <pass|drop|tx|aborted> [src <cidr>] [dst <cidr>] [proto <tcp|udp|icmp|num>]
+ *                          [sport <lo>[-<hi>]] [dport <lo>[-<hi>]]
+ *                          [flags <set>[/<mask>]]
+ *
+ * flags are TCP flag names joined by '+', e.g. "flags syn/syn+ack" for a
+ * SYN without ACK. The first matching rule decides the verdict, a pass
+ * verdict continues into the LB.
+ */
+int classifier_load_file(const struct config *cfg);
+/* Same, into the maps of an unpinned object */
+int classifier_load_obj(struct bpf_object *obj, const char *filename);
+
+struct classifier_stats
+{
+    int ctl_fd;
+    int action_fd;
+    int stat_fd;
+    int nr_cpus;
+    __u64 ts;
+    /* Rule set the counters were read from, and its length */
+    __u8 set;
+    __u32 nr_rules;
+    struct datarec rule[CLS_MAX_RULES];
+};
+
+int classifier_stats_open(const struct config *cfg, struct classifier_stats *stats);
+void classifier_stats_collect(struct classifier_stats *stats);
+void classifier_stats_print(struct classifier_stats *stats, struct classifier_stats *prev);
+
+#endif
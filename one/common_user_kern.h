@@ -2,10 +2,176 @@
 #define __ONE_USER_KERN_H
 
 #include <linux/types.h>
+#include <linux/if_ether.h>
 
 struct datarec
 {
     __u64 rx_pkts;
+    __u64 rx_bytes;
 };
 
-#endif
\ No newline at end of file
+/*
+ * Load-time switches, placed in .rodata by xdp_prog_kern.c and filled in
+ * by the loader before load so the verifier prunes disabled branches.
+ */
+struct xdp_features
+{
+    __u32 count_bytes;
+    __u32 size_histogram;
+    __u32 filter;
+    /* Check xdp_filter_bloom before the denylist hash */
+    __u32 filter_bloom;
+    __u32 tunnel_decap;
+    __u32 classifier;
+    /* Account 1 in sample_rate packets with weight sample_rate, 0/1: all */
+    __u32 sample_rate;
+    /* Maglev L4 LB of TCP/UDP to the VIPs in lb_vip_map */
+    __u32 lb;
+};
+
+/* Frame size histogram, bucket i < SIZE_HIST_BUCKETS - 1 counts frames below 64 << i */
+#define SIZE_HIST_BUCKETS 8
+#define SIZE_HIST_BOUND(i) (64U << (i))
+
+/* Initial denylist size, filter_user.c grows it on demand */
+#define FILTER_INIT_ENTRIES 1024
+
+/* Denylist lookup outcomes, BLOOM_FP is a bloom hit the hash did not confirm */
+enum filter_stat
+{
+    FILTER_STAT_HIT,
+    FILTER_STAT_MISS,
+    FILTER_STAT_BLOOM_FP,
+    FILTER_STAT_MAX,
+};
+
+/* Per RX queue counters, higher queue indexes share the last slot */
+#define RXQ_MAX 64
+
+/* Tunnel decap, endpoints are keyed by outer dst addr and encap type */
+#define TUN_MAX 64
+#define VXLAN_PORT 4789
+/* I flag in vx_flags, the VNI is valid */
+#define VXLAN_F_VNI 0x08000000
+
+enum tun_type
+{
+    TUN_VXLAN = 1,
+    TUN_GRE = 2,
+};
+
+struct tun_key
+{
+    __be32 addr;
+    __u32 type;
+    /* VXLAN only, as in vx_vni: VNI << 8, network order. 0 for GRE */
+    __be32 vni;
+};
+
+struct tun_info
+{
+    __u32 tun_idx;
+    /* Redirect the inner frame here, 0 hands it to the local stack */
+    __u32 ifindex;
+};
+
+/*
+ * Multi-field classifier, see classifier_user.c for the compiler. Every
+ * field table maps a packet field to the bitmap of rules it satisfies;
+ * ANDing them and taking the lowest set bit gives the first matching
+ * rule. Keys carry a table set index so userspace can build the next
+ * set next to the live one and flip cls_ctl.active.
+ */
+#define CLS_MAX_RULES 2048
+#define CLS_BITMAP_WORDS (CLS_MAX_RULES / 64)
+#define CLS_NO_MATCH 0xffffffff
+#define CLS_ADDR_PREFIXES (2 * (CLS_MAX_RULES + 1))
+#define CLS_PORT_PREFIXES 16384
+
+struct cls_bitmap
+{
+    __u64 w[CLS_BITMAP_WORDS];
+};
+
+struct cls_addr_key
+{
+    __u32 prefixlen;
+    __u8 set;
+    __be32 addr;
+} __attribute__((packed));
+
+struct cls_port_key
+{
+    __u32 prefixlen;
+    __u8 set;
+    __be16 port;
+} __attribute__((packed));
+
+/* Array fields are indexed by set * 256 + value */
+#define CLS_ARRAY_KEY(set, val) ((set) * 256 + (val))
+
+struct cls_ctl
+{
+    __u32 active;
+    __u32 nr_rules;
+};
+
+/* L4 load balancer, see lb_user.c for how the tables are filled */
+#define LB_MAX_VIPS 16
+#define LB_MAX_BACKENDS 256
+/* Maglev lookup table size per VIP, must be prime and >> LB_MAX_BACKENDS */
+#define LB_MAGLEV_SIZE 65537
+/* Each VIP owns two tables, userspace fills the idle one and flips */
+#define LB_MAGLEV_ENTRIES (LB_MAX_VIPS * 2 * LB_MAGLEV_SIZE)
+#define LB_BACKEND_NONE 0xffffffff
+
+struct lb_vip_key
+{
+    __be32 addr;
+    __be16 port;
+    __u8 proto;
+    __u8 pad;
+};
+
+struct lb_vip_meta
+{
+    __u32 vip_idx;
+    __u32 table_sel;
+};
+
+struct lb_backend
+{
+    __be32 addr;
+    __u32 ifindex;
+    __u8 mac[ETH_ALEN];
+    /* Source MAC when redirecting out of ifindex */
+    __u8 smac[ETH_ALEN];
+};
+
+/*
+ * Parse results XDP leaves in front of the frame (bpf_xdp_adjust_meta)
+ * for tc_classify_prog, so TC does not walk the headers a second time.
+ * Size must stay a multiple of 4.
+ */
+#define XDP_META_MAGIC 0x584d4554 /* "XMET" */
+
+struct xdp_meta
+{
+    __u16 l3_off;
+    __u16 l4_off;
+    __u32 flow_hash;
+    __u32 class_id;
+    __u32 magic;
+};
+
+/* Classification id handed to TC: IP protocol and host order dst port */
+#define FLOW_CLASS_ID(proto, dport) (((__u32)(proto) << 16) | (dport))
+
+enum tc_stat
+{
+    TC_STAT_META = 0,
+    TC_STAT_REPARSE,
+    TC_STAT_MAX,
+};
+
+#endif
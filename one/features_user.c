@@ -0,0 +1,32 @@
+#include <string.h>
+
+#include "features_user.h"
+
+void xdp_features_from_cfg(const struct config *cfg, struct xdp_features *features)
+{
+    memset(features, 0, sizeof(*features));
+    features->count_bytes = !cfg->no_count_bytes;
+    features->size_histogram = cfg->size_hist;
+    features->filter = cfg->filter_file[0] != '\0';
+    features->filter_bloom = cfg->filter_file[0] != '\0' && cfg->bloom_fp > 0;
+    features->tunnel_decap = cfg->tun_file[0] != '\0';
+    features->classifier = cfg->rules_file[0] != '\0';
+    features->sample_rate = cfg->sample_rate;
+    features->lb = cfg->lb_conf[0] != '\0';
+}
+
+void xdp_features_stub_maps(const struct xdp_features *features, const char *names[XDP_FEATURES_STUB_MAX + 1])
+{
+    int nr = 0;
+    /* 16 VIPs x 2 tables x 65537 slots, 8 MB of u32 */
+    if (!features->lb)
+    {
+        names[nr++] = "lb_maglev_map";
+    }
+    /* Bloom filter maps need 5.16, an array template lets the rest load on older kernels */
+    if (!features->filter_bloom)
+    {
+        names[nr++] = "xdp_filter_bloom_inner";
+    }
+    names[nr] = NULL;
+}
@@ -0,0 +1,18 @@
+#ifndef __ONE_FEATURES_USER_H
+#define __ONE_FEATURES_USER_H
+
+#include "../global/common_define.h"
+#include "common_user_kern.h"
+
+/*
+ * The .rodata switches xdp_stat_prog is loaded with for these options.
+ * No options gives the defaults compiled into xdp_prog_kern.c.
+ */
+void xdp_features_from_cfg(const struct config *cfg, struct xdp_features *features);
+
+#define XDP_FEATURES_STUB_MAX 4
+
+/* Fills names with the NULL-terminated maps features leave unread, for cfg->stub_maps */
+void xdp_features_stub_maps(const struct xdp_features *features, const char *names[XDP_FEATURES_STUB_MAX + 1]);
+
+#endif
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "../global/common_define.h"
+#include "../global/xdp_helper.h"
+#include "../global/map_resize.h"
+#include "../global/map_batch.h"
+#include "common_user_kern.h"
+#include "filter_user.h"
+
+#define FILTER_BATCH 1024
+
+static int filter_update(int map_fd, __be32 *keys, __u32 *values, __u32 count)
+{
+    return map_update_batch_compat(map_fd, keys, values, count, sizeof(*keys), sizeof(*values));
+}
+
+int filter_resize(const struct config *cfg)
+{
+    int outer_fd = open_bpf_map_file_by_name(cfg, "xdp_filter_map", NULL);
+    if (outer_fd < 0)
+    {
+        return EXIT_FAIL_BPF;
+    }
+
+    int err = map_in_map_resize(outer_fd, 0, cfg->filter_size);
+    close(outer_fd);
+    if (err)
+    {
+        fprintf(stderr, "ERR: resize filter to %u entries failed(%d): %s\n", cfg->filter_size, -err, strerror(-err));
+        return EXIT_FAIL_BPF;
+    }
+    return EXIT_OK;
+}
+
+/* Reads the whole file first, the bloom filter is sized by the address count */
+static int filter_read(const char *filename, __be32 **addrs, __u32 *nr)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: open filter file(%s) failed(%d): %s\n", filename, err, strerror(err));
+        return -err;
+    }
+
+    __u32 cap = FILTER_BATCH;
+    *nr = 0;
+    *addrs = malloc(cap * sizeof(**addrs));
+
+    int lineno = 0, err = 0;
+    char line[64], addr[INET_ADDRSTRLEN];
+    while (*addrs && fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+        if (sscanf(line, "%15s", addr) != 1)
+        {
+            continue;
+        }
+
+        if (*nr == cap)
+        {
+            cap *= 2;
+            __be32 *grown = realloc(*addrs, cap * sizeof(**addrs));
+            if (!grown)
+            {
+                break;
+            }
+            *addrs = grown;
+        }
+        if (inet_pton(AF_INET, addr, &(*addrs)[*nr]) != 1)
+        {
+            fprintf(stderr, "ERR: filter file(%s) line %d invalid: %s\n", filename, lineno, addr);
+            err = -EINVAL;
+            break;
+        }
+        (*nr)++;
+    }
+    if (!err && (!*addrs || !feof(fp)))
+    {
+        err = -ENOMEM;
+    }
+    fclose(fp);
+
+    if (err)
+    {
+        free(*addrs);
+        *addrs = NULL;
+    }
+    return err;
+}
+
+/*
+ * Like the bloom, every load builds a fresh table from the file and swaps
+ * it in, so addrs no longer listed stop matching. It starts at the live
+ * table's size (FILTER_INIT_ENTRIES or --filter-size) and doubles until
+ * the file fits.
+ */
+static int filter_hash_load(int outer_fd, __be32 *addrs, __u32 nr)
+{
+    int old_fd = map_in_map_get(outer_fd, 0);
+    if (old_fd < 0)
+    {
+        fprintf(stderr, "ERR: get filter table failed(%d): %s\n", -old_fd, strerror(-old_fd));
+        return old_fd;
+    }
+
+    struct bpf_map_info info = {0};
+    __u32 info_len = sizeof(info);
+    int err = bpf_obj_get_info_by_fd(old_fd, &info, &info_len) ? -errno : 0;
+    close(old_fd);
+    if (err)
+    {
+        return err;
+    }
+
+    __u32 entries = info.max_entries;
+    while (entries < nr && entries <= UINT32_MAX / 2)
+    {
+        entries *= 2;
+    }
+
+    int map_fd = bpf_create_map_name(info.type, info.name, info.key_size, info.value_size, entries, info.map_flags);
+    if (map_fd < 0)
+    {
+        err = -errno;
+        fprintf(stderr, "ERR: create filter table with %u entries failed(%d): %s\n", entries, -err, strerror(-err));
+        return err;
+    }
+
+    __u32 values[FILTER_BATCH];
+    for (__u32 i = 0; i < FILTER_BATCH; i++)
+    {
+        values[i] = 1;
+    }
+
+    for (__u32 off = 0; off < nr && !err; off += FILTER_BATCH)
+    {
+        __u32 count = nr - off < FILTER_BATCH ? nr - off : FILTER_BATCH;
+        err = filter_update(map_fd, &addrs[off], values, count);
+    }
+
+    __u32 slot = 0;
+    if (!err && bpf_map_update_elem(outer_fd, &slot, &map_fd, BPF_ANY))
+    {
+        err = -errno;
+    }
+    close(map_fd);
+
+    if (!err && entries != info.max_entries)
+    {
+        printf("INFO: filter table grown %u -> %u entries\n", info.max_entries, entries);
+    }
+    return err;
+}
+
+/*
+ * Legacy map defs cannot set map_extra, so the kernel default of 5
+ * hashes applies and the FP rate is reached through sizing instead: the
+ * bitmap gets max_entries * k / ln2 bits, so n addresses in E entries
+ * give fp = (1 - 2^(-n/E))^k.
+ */
+#define FILTER_BLOOM_HASHES 5
+/* Rebuilds of a bloom the prog was loaded with, when no --bloom-fp is given */
+#define FILTER_BLOOM_DEFAULT_FP 0.01
+
+static __u32 filter_bloom_entries(__u32 nr, double fp_rate)
+{
+    double per_entry = -log2(1 - pow(fp_rate, 1.0 / FILTER_BLOOM_HASHES));
+    double entries = ceil(nr / per_entry);
+    if (entries < 1)
+    {
+        return 1;
+    }
+    return entries > UINT32_MAX / FILTER_BLOOM_HASHES ? UINT32_MAX / FILTER_BLOOM_HASHES : entries;
+}
+
+/* An empty slot makes filter_match() go straight to the hash */
+static int filter_bloom_disable(int bloom_outer_fd, int err)
+{
+    fprintf(stderr, "WARN: build bloom filter failed(%d): %s, checking the hash only\n", -err, strerror(-err));
+
+    __u32 slot = 0;
+    if (bpf_map_delete_elem(bloom_outer_fd, &slot) && errno != ENOENT)
+    {
+        return -errno;
+    }
+    return 0;
+}
+
+/* Bloom filters cannot delete, every load builds a fresh one and swaps it in */
+static int filter_bloom_load(int bloom_outer_fd, __be32 *addrs, __u32 nr, double fp_rate)
+{
+    __u32 entries = filter_bloom_entries(nr, fp_rate);
+    int fd = bpf_create_map_name(BPF_MAP_TYPE_BLOOM_FILTER, "xdp_filter_bloom", 0, sizeof(__be32), entries, 0);
+    if (fd < 0)
+    {
+        return filter_bloom_disable(bloom_outer_fd, -errno);
+    }
+
+    /* No batch ops for bloom filters */
+    int err = 0;
+    for (__u32 i = 0; i < nr && !err; i++)
+    {
+        if (bpf_map_update_elem(fd, NULL, &addrs[i], BPF_ANY))
+        {
+            err = -errno;
+        }
+    }
+
+    __u32 slot = 0;
+    if (!err && bpf_map_update_elem(bloom_outer_fd, &slot, &fd, BPF_ANY))
+    {
+        err = -errno;
+    }
+    close(fd);
+
+    if (err)
+    {
+        return filter_bloom_disable(bloom_outer_fd, err);
+    }
+    printf("INFO: filter bloom sized %u entries for %u addrs at fp %g\n", entries, nr, fp_rate);
+    return 0;
+}
+
+int filter_load(const char *filename, int outer_fd, int bloom_outer_fd, double fp_rate)
+{
+    __be32 *addrs;
+    __u32 nr;
+    int err = filter_read(filename, &addrs, &nr);
+    if (err)
+    {
+        return EXIT_FAIL;
+    }
+
+    /*
+     * Hash first, so a bloom hit always finds its entry. Only that way
+     * round: until the new bloom is swapped in, addrs new to the hash
+     * still miss the old bloom and pass.
+     */
+    err = filter_hash_load(outer_fd, addrs, nr);
+    if (!err && bloom_outer_fd >= 0)
+    {
+        err = filter_bloom_load(bloom_outer_fd, addrs, nr, fp_rate);
+    }
+    free(addrs);
+
+    if (err)
+    {
+        fprintf(stderr, "ERR: load filter file(%s) failed(%d): %s\n", filename, -err, strerror(-err));
+        return EXIT_FAIL_BPF;
+    }
+
+    printf("INFO: filter file(%s) loaded %u addrs\n", filename, nr);
+    return EXIT_OK;
+}
+
+int filter_load_file(const struct config *cfg)
+{
+    int outer_fd = open_bpf_map_file_by_name(cfg, "xdp_filter_map", NULL);
+    if (outer_fd < 0)
+    {
+        return EXIT_FAIL_BPF;
+    }
+
+    /*
+     * Whether the bloom is checked was fixed in .rodata at load, not by
+     * this run's options: rebuild it whenever the attached prog reads it,
+     * or it would hide the new addrs, and never otherwise.
+     */
+    struct xdp_features features;
+    int err = xdp_prog_rodata(cfg->netif_idx, &features, sizeof(features));
+    if (err)
+    {
+        fprintf(stderr, "WARN: read features of attached prog failed(%d): %s\n", -err, strerror(-err));
+        features.filter_bloom = cfg->bloom_fp > 0;
+    }
+
+    int bloom_outer_fd = -1;
+    if (features.filter_bloom)
+    {
+        bloom_outer_fd = open_bpf_map_file_by_name(cfg, "xdp_filter_bloom", NULL);
+        if (bloom_outer_fd < 0)
+        {
+            close(outer_fd);
+            return EXIT_FAIL_BPF;
+        }
+    }
+    double fp_rate = cfg->bloom_fp > 0 ? cfg->bloom_fp : FILTER_BLOOM_DEFAULT_FP;
+
+    err = filter_load(cfg->filter_file, outer_fd, bloom_outer_fd, fp_rate);
+    if (bloom_outer_fd >= 0)
+    {
+        close(bloom_outer_fd);
+    }
+    close(outer_fd);
+    return err;
+}
+
+static const char *filter_stat_names[FILTER_STAT_MAX] = {
+    [FILTER_STAT_HIT] = "FILTER_HIT",
+    [FILTER_STAT_MISS] = "FILTER_MISS",
+    [FILTER_STAT_BLOOM_FP] = "BLOOM_FP",
+};
+
+const char *filter_stat2str(__u32 key)
+{
+    if (key < FILTER_STAT_MAX)
+    {
+        return filter_stat_names[key];
+    }
+    return NULL;
+}
+
+void filter_stat_totals_print(int stat_fd)
+{
+    int nr_cpus = libbpf_num_possible_cpus();
+    if (stat_fd < 0 || nr_cpus <= 0)
+    {
+        return;
+    }
+
+    struct datarec values[nr_cpus];
+    printf("\nxdp_filter_stat_map\n");
+    for (__u32 key = 0; key < FILTER_STAT_MAX; key++)
+    {
+        __u64 pkts = 0;
+        if (bpf_map_lookup_elem(stat_fd, &key, values))
+        {
+            continue;
+        }
+        for (int cpu = 0; cpu < nr_cpus; cpu++)
+        {
+            pkts += values[cpu].rx_pkts;
+        }
+        printf("%-12s %'14llu pkts\n", filter_stat2str(key), pkts);
+    }
+}
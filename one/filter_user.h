@@ -0,0 +1,25 @@
+#ifndef __ONE_FILTER_USER_H
+#define __ONE_FILTER_USER_H
+
+#include "../global/common_define.h"
+
+/*
+ * --filter file format: one IPv4 source address per line, '#' starts a
+ * comment. Matching packets are dropped by xdp_stat_prog, a reload
+ * replaces the whole list. With
+ * --bloom-fp the same addresses also go into a bloom filter checked
+ * first, sized for that false-positive rate. Only --bloom-fp needs
+ * kernel 5.16; if a bloom cannot be built the prog checks the hash only.
+ */
+int filter_load_file(const struct config *cfg);
+/* Same, into the maps of an unpinned object, bloom_outer_fd < 0: no bloom */
+int filter_load(const char *filename, int outer_fd, int bloom_outer_fd, double fp_rate);
+
+/* Swaps in a denylist table of cfg->filter_size entries, keeping its contents */
+int filter_resize(const struct config *cfg);
+
+const char *filter_stat2str(__u32 key);
+/* Totals of xdp_filter_stat_map across CPUs, for one-shot tools */
+void filter_stat_totals_print(int stat_fd);
+
+#endif
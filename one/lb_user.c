@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <bpf/bpf.h>
+
+#include "../global/common_define.h"
+#include "../global/xdp_helper.h"
+#include "../global/maglev.h"
+#include "../global/map_batch.h"
+#include "lb_user.h"
+
+struct lb_vip_conf
+{
+    struct lb_vip_key key;
+    __u32 nr_backends;
+    __u32 backend_ids[LB_MAX_BACKENDS];
+};
+
+struct lb_conf
+{
+    __u32 nr_vips;
+    struct lb_vip_conf vips[LB_MAX_VIPS];
+    __u32 nr_backends;
+    struct lb_backend backends[LB_MAX_BACKENDS];
+};
+
+static int lb_ifname_mac(const char *ifname, __u8 *mac)
+{
+    struct ifreq ifr = {0};
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    strncpy(ifr.ifr_name, ifname, IF_NAMESIZE - 1);
+    int err = ioctl(fd, SIOCGIFHWADDR, &ifr) ? -errno : 0;
+    close(fd);
+    if (!err)
+    {
+        memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    }
+    return err;
+}
+
+static int lb_conf_backend_idx(struct lb_conf *conf, const struct lb_backend *backend)
+{
+    for (__u32 i = 0; i < conf->nr_backends; i++)
+    {
+        if (conf->backends[i].addr == backend->addr)
+        {
+            /* One slot per address, a second mac or ifname cannot be honoured */
+            if (memcmp(&conf->backends[i], backend, sizeof(*backend)))
+            {
+                return -EEXIST;
+            }
+            return i;
+        }
+    }
+
+    if (conf->nr_backends >= LB_MAX_BACKENDS)
+    {
+        return -ENOSPC;
+    }
+    conf->backends[conf->nr_backends] = *backend;
+    return conf->nr_backends++;
+}
+
+static int lb_conf_parse(const char *filename, struct lb_conf *conf)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: open lb conf(%s) failed(%d): %s\n", filename, err, strerror(err));
+        return -err;
+    }
+
+    char line[256];
+    int lineno = 0, err = 0;
+    struct lb_vip_conf *vip = NULL;
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char kind[16], addr[INET_ADDRSTRLEN], arg[32], ifname[IF_NAMESIZE] = "";
+        unsigned int port;
+        int n = sscanf(line, "%15s %15s %31s %u", kind, addr, arg, &port);
+        if (n <= 0)
+        {
+            continue;
+        }
+
+        if (!strcmp(kind, "vip") && n == 4)
+        {
+            if (conf->nr_vips >= LB_MAX_VIPS || port > 0xffff)
+            {
+                err = -EINVAL;
+                break;
+            }
+            vip = &conf->vips[conf->nr_vips++];
+            vip->key.port = htons(port);
+            if (!strcmp(arg, "tcp"))
+            {
+                vip->key.proto = IPPROTO_TCP;
+            }
+            else if (!strcmp(arg, "udp"))
+            {
+                vip->key.proto = IPPROTO_UDP;
+            }
+            else
+            {
+                err = -EINVAL;
+                break;
+            }
+            if (inet_pton(AF_INET, addr, &vip->key.addr) != 1)
+            {
+                err = -EINVAL;
+                break;
+            }
+        }
+        else if (!strcmp(kind, "backend") && n >= 3 && vip)
+        {
+            struct lb_backend backend = {0};
+            __u8 *mac = backend.mac;
+            if (inet_pton(AF_INET, addr, &backend.addr) != 1 ||
+                sscanf(arg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 6)
+            {
+                err = -EINVAL;
+                break;
+            }
+            if (sscanf(line, "%*s %*s %*s %15s", ifname) == 1 &&
+                (!(backend.ifindex = if_nametoindex(ifname)) || lb_ifname_mac(ifname, backend.smac)))
+            {
+                err = -ENODEV;
+                break;
+            }
+
+            int idx = lb_conf_backend_idx(conf, &backend);
+            if (idx < 0)
+            {
+                err = idx;
+                break;
+            }
+            if (vip->nr_backends >= LB_MAX_BACKENDS)
+            {
+                err = -ENOSPC;
+                break;
+            }
+            vip->backend_ids[vip->nr_backends++] = idx;
+        }
+        else
+        {
+            err = -EINVAL;
+            break;
+        }
+    }
+    fclose(fp);
+
+    if (err)
+    {
+        fprintf(stderr, "ERR: lb conf(%s) line %d invalid(%d): %s\n", filename, lineno, -err, strerror(-err));
+    }
+    return err;
+}
+
+/*
+ * Map conf backend indexes to slots in lb_backend_map. A backend that is
+ * already loaded keeps its slot, so its counters and table entries carry
+ * over; stale[] marks slots no longer referenced by the new conf.
+ */
+static int lb_assign_backend_ids(int backend_fd, struct lb_conf *conf, __u32 *ids, bool *stale)
+{
+    struct lb_backend curr[LB_MAX_BACKENDS] = {0};
+    bool used[LB_MAX_BACKENDS] = {0};
+
+    for (__u32 id = 0; id < LB_MAX_BACKENDS; id++)
+    {
+        bpf_map_lookup_elem(backend_fd, &id, &curr[id]);
+    }
+
+    for (__u32 i = 0; i < conf->nr_backends; i++)
+    {
+        ids[i] = LB_BACKEND_NONE;
+        for (__u32 id = 0; id < LB_MAX_BACKENDS; id++)
+        {
+            if (curr[id].addr && curr[id].addr == conf->backends[i].addr)
+            {
+                ids[i] = id;
+                used[id] = true;
+                break;
+            }
+        }
+    }
+
+    for (__u32 i = 0; i < conf->nr_backends; i++)
+    {
+        for (__u32 id = 0; ids[i] == LB_BACKEND_NONE && id < LB_MAX_BACKENDS; id++)
+        {
+            if (!curr[id].addr && !used[id])
+            {
+                ids[i] = id;
+                used[id] = true;
+            }
+        }
+        if (ids[i] == LB_BACKEND_NONE)
+        {
+            fprintf(stderr, "ERR: %s() no free backend slot\n", __func__);
+            return -ENOSPC;
+        }
+    }
+
+    for (__u32 id = 0; id < LB_MAX_BACKENDS; id++)
+    {
+        stale[id] = curr[id].addr && !used[id];
+    }
+    return 0;
+}
+
+static int lb_write_table(int maglev_fd, __u32 base, __u32 *table)
+{
+    static __u32 keys[LB_MAGLEV_SIZE];
+    for (__u32 i = 0; i < LB_MAGLEV_SIZE; i++)
+    {
+        keys[i] = base + i;
+    }
+
+    return map_update_batch_compat(maglev_fd, keys, table, LB_MAGLEV_SIZE, sizeof(*keys), sizeof(*table));
+}
+
+static int lb_alloc_vip_idx(int vip_fd, const bool *taken_new)
+{
+    bool taken[LB_MAX_VIPS];
+    memcpy(taken, taken_new, sizeof(taken));
+
+    struct lb_vip_key key, next;
+    struct lb_vip_meta meta;
+    void *prev_key = NULL;
+    while (!bpf_map_get_next_key(vip_fd, prev_key, &next))
+    {
+        if (!bpf_map_lookup_elem(vip_fd, &next, &meta) && meta.vip_idx < LB_MAX_VIPS)
+        {
+            taken[meta.vip_idx] = true;
+        }
+        key = next;
+        prev_key = &key;
+    }
+
+    for (__u32 idx = 0; idx < LB_MAX_VIPS; idx++)
+    {
+        if (!taken[idx])
+        {
+            return idx;
+        }
+    }
+    return -ENOSPC;
+}
+
+static bool lb_conf_has_vip(const struct lb_conf *conf, const struct lb_vip_key *key)
+{
+    for (__u32 i = 0; i < conf->nr_vips; i++)
+    {
+        if (!memcmp(&conf->vips[i].key, key, sizeof(*key)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int lb_apply_conf(const struct config *cfg)
+{
+    static struct lb_conf conf;
+    static __u32 table[LB_MAGLEV_SIZE];
+    memset(&conf, 0, sizeof(conf));
+
+    int err = lb_conf_parse(cfg->lb_conf, &conf);
+    if (err)
+    {
+        return EXIT_FAIL;
+    }
+
+    int vip_fd = open_bpf_map_file_by_name(cfg, "lb_vip_map", NULL);
+    int maglev_fd = open_bpf_map_file_by_name(cfg, "lb_maglev_map", NULL);
+    int backend_fd = open_bpf_map_file_by_name(cfg, "lb_backend_map", NULL);
+    if (vip_fd < 0 || maglev_fd < 0 || backend_fd < 0)
+    {
+        return EXIT_FAIL_BPF;
+    }
+
+    __u32 ids[LB_MAX_BACKENDS];
+    bool stale[LB_MAX_BACKENDS];
+    if (lb_assign_backend_ids(backend_fd, &conf, ids, stale))
+    {
+        return EXIT_FAIL;
+    }
+
+    for (__u32 i = 0; i < conf.nr_backends; i++)
+    {
+        if (bpf_map_update_elem(backend_fd, &ids[i], &conf.backends[i], BPF_ANY))
+        {
+            fprintf(stderr, "ERR: update backend(%u) failed\n", ids[i]);
+            return EXIT_FAIL_BPF;
+        }
+    }
+
+    /* Retire VIPs dropped from the conf, frees their slots for new ones */
+    struct lb_vip_key key, next;
+    void *prev_key = NULL;
+    while (!bpf_map_get_next_key(vip_fd, prev_key, &next))
+    {
+        if (!lb_conf_has_vip(&conf, &next))
+        {
+            bpf_map_delete_elem(vip_fd, &next);
+            continue;
+        }
+        key = next;
+        prev_key = &key;
+    }
+
+    bool vip_taken[LB_MAX_VIPS] = {0};
+    for (__u32 i = 0; i < conf.nr_vips; i++)
+    {
+        struct lb_vip_conf *vip = &conf.vips[i];
+        struct lb_vip_meta meta;
+        if (!bpf_map_lookup_elem(vip_fd, &vip->key, &meta))
+        {
+            meta.table_sel = !meta.table_sel;
+        }
+        else
+        {
+            int idx = lb_alloc_vip_idx(vip_fd, vip_taken);
+            if (idx < 0)
+            {
+                fprintf(stderr, "ERR: no free vip slot\n");
+                return EXIT_FAIL;
+            }
+            meta.vip_idx = idx;
+            meta.table_sel = 0;
+        }
+        vip_taken[meta.vip_idx] = true;
+
+        if (vip->nr_backends)
+        {
+            __u64 keys[LB_MAX_BACKENDS];
+            __u32 vip_ids[LB_MAX_BACKENDS];
+            for (__u32 j = 0; j < vip->nr_backends; j++)
+            {
+                keys[j] = conf.backends[vip->backend_ids[j]].addr;
+                vip_ids[j] = ids[vip->backend_ids[j]];
+            }
+            err = maglev_populate(table, LB_MAGLEV_SIZE, keys, vip_ids, vip->nr_backends);
+        }
+        else
+        {
+            memset(table, 0xff, sizeof(table));
+        }
+
+        /* Fill the idle half first, then flip table_sel in one map update */
+        if (!err)
+        {
+            err = lb_write_table(maglev_fd, (meta.vip_idx * 2 + meta.table_sel) * LB_MAGLEV_SIZE, table);
+        }
+        if (!err)
+        {
+            err = bpf_map_update_elem(vip_fd, &vip->key, &meta, BPF_ANY);
+        }
+        if (err)
+        {
+            fprintf(stderr, "ERR: load vip(%u) table failed(%d)\n", meta.vip_idx, err);
+            return EXIT_FAIL_BPF;
+        }
+    }
+
+    /* Only now is no table pointing at the stale backends */
+    struct lb_backend none = {0};
+    for (__u32 id = 0; id < LB_MAX_BACKENDS; id++)
+    {
+        if (stale[id])
+        {
+            bpf_map_update_elem(backend_fd, &id, &none, BPF_ANY);
+        }
+    }
+
+    printf("INFO: lb conf(%s) loaded %u vips %u backends\n", cfg->lb_conf, conf.nr_vips, conf.nr_backends);
+    return EXIT_OK;
+}
+
+int lb_stats_open(const struct config *cfg, struct lb_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->vip_fd = open_bpf_map_file_by_name(cfg, "lb_vip_map", NULL);
+    stats->vip_stat_fd = open_bpf_map_file_by_name(cfg, "lb_vip_stat_map", NULL);
+    stats->backend_fd = open_bpf_map_file_by_name(cfg, "lb_backend_map", NULL);
+    stats->backend_stat_fd = open_bpf_map_file_by_name(cfg, "lb_backend_stat_map", NULL);
+    if (stats->vip_fd < 0 || stats->vip_stat_fd < 0 || stats->backend_fd < 0 || stats->backend_stat_fd < 0)
+    {
+        return EXIT_FAIL_BPF;
+    }
+    return EXIT_OK;
+}
+
+void lb_stats_collect(struct lb_stats *stats)
+{
+    stats->ts = gettime();
+    for (__u32 key = 0; key < LB_MAX_VIPS; key++)
+    {
+        bpf_map_lookup_elem(stats->vip_stat_fd, &key, &stats->vip[key]);
+    }
+    for (__u32 key = 0; key < LB_MAX_BACKENDS; key++)
+    {
+        bpf_map_lookup_elem(stats->backend_stat_fd, &key, &stats->backend[key]);
+    }
+}
+
+static void lb_print_rec(const char *label, struct datarec *rec, struct datarec *prev, double period)
+{
+    __u64 pkts = rec->rx_pkts - prev->rx_pkts;
+    __u64 bytes = rec->rx_bytes - prev->rx_bytes;
+    printf("%-28s %lld pkts (%'10.0f pps) %'11.2f Mbit/s\n",
+           label, pkts, pkts / period, (double)bytes * 8 / period / 1000000);
+}
+
+void lb_stats_print(struct lb_stats *stats, struct lb_stats *prev)
+{
+    double period = (double)(stats->ts - prev->ts) / NANOSEC_PER_SEC;
+    if (period <= 0)
+    {
+        return;
+    }
+
+    char addr[INET_ADDRSTRLEN], label[64];
+    struct lb_vip_key key, next;
+    struct lb_vip_meta meta;
+    void *prev_key = NULL;
+    while (!bpf_map_get_next_key(stats->vip_fd, prev_key, &next))
+    {
+        if (!bpf_map_lookup_elem(stats->vip_fd, &next, &meta) && meta.vip_idx < LB_MAX_VIPS)
+        {
+            inet_ntop(AF_INET, &next.addr, addr, sizeof(addr));
+            snprintf(label, sizeof(label), "vip %s:%u/%s", addr, ntohs(next.port),
+                     next.proto == IPPROTO_TCP ? "tcp" : "udp");
+            lb_print_rec(label, &stats->vip[meta.vip_idx], &prev->vip[meta.vip_idx], period);
+        }
+        key = next;
+        prev_key = &key;
+    }
+
+    struct lb_backend backend;
+    for (__u32 id = 0; id < LB_MAX_BACKENDS; id++)
+    {
+        if (bpf_map_lookup_elem(stats->backend_fd, &id, &backend) || !backend.addr)
+        {
+            continue;
+        }
+        inet_ntop(AF_INET, &backend.addr, addr, sizeof(addr));
+        snprintf(label, sizeof(label), "  backend[%u] %s", id, addr);
+        lb_print_rec(label, &stats->backend[id], &prev->backend[id], period);
+    }
+}
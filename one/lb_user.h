@@ -0,0 +1,37 @@
+#ifndef __ONE_LB_USER_H
+#define __ONE_LB_USER_H
+
+#include <linux/types.h>
+
+#include "../global/common_define.h"
+#include "common_user_kern.h"
+
+/*
+ * --lb-conf file format, one directive per line, '#' starts a comment:
+ *
+ *   vip <ipv4> <tcp|udp> <port>
+ *   backend <ipv4> <mac> [<ifname>]
+ *
+ * backend lines belong to the closest vip line above them. A backend
+ * without ifname is sent back out of the receiving interface (XDP_TX),
+ * otherwise it is redirected with ifname's MAC as source. An address
+ * may appear under several vips but always with the same mac and ifname.
+ */
+int lb_apply_conf(const struct config *cfg);
+
+struct lb_stats
+{
+    int vip_fd;
+    int vip_stat_fd;
+    int backend_fd;
+    int backend_stat_fd;
+    __u64 ts;
+    struct datarec vip[LB_MAX_VIPS];
+    struct datarec backend[LB_MAX_BACKENDS];
+};
+
+int lb_stats_open(const struct config *cfg, struct lb_stats *stats);
+void lb_stats_collect(struct lb_stats *stats);
+void lb_stats_print(struct lb_stats *stats, struct lb_stats *prev);
+
+#endif
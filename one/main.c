@@ -6,17 +6,28 @@
 #include <bpf/libbpf.h>
 #include <linux/if_link.h>
 #include <locale.h>
+#include <signal.h>
 #include <unistd.h>
 #include <time.h>
+#include <dirent.h>
+#include <limits.h>
 
 #include "../global/common_define.h"
 #include "../global/cmd_args.h"
 #include "../global/xdp_helper.h"
+#include "../global/ts_ring.h"
 #include "common_user_kern.h"
+#include "lb_user.h"
+#include "filter_user.h"
+#include "tunnel_user.h"
+#include "classifier_user.h"
+#include "features_user.h"
 
 static const char *default_bpf_obj_filename = "xdp_prog_kern.o";
 static const char *default_pin_basedir = "/sys/fs/bpf";
 static const char *default_map_name = "xdp_stat_map";
+static const char *default_tc_filename = "tc_prog_kern.o";
+static const char *tc_stat_map_name = "tc_stat_map";
 
 struct option_wrapper wrappers[] = {
     {{"dev", required_argument, NULL, 'd'}, "device name", .required = true},
@@ -29,9 +40,25 @@ struct option_wrapper wrappers[] = {
     {{"mapname", required_argument, NULL, 4}, "mapname", "<mapname>"},
 
     {{"pinmap", no_argument, NULL, 5}, "pinmap", "<pinmap>"},
+
+    {{"ts-file", required_argument, NULL, 6}, "append counter history to mmap'd ring file", "<file>"},
+    {{"ts-entries", required_argument, NULL, 7}, "ring file capacity in intervals", "<num>"},
+    {{"lb-conf", required_argument, NULL, 10}, "load balancer VIPs and backends", "<file>"},
+    {{"tc-filename", required_argument, NULL, 11}, "TC prog paired with the XDP prog", "<file>"},
+
+    {{"no-bytes", no_argument, NULL, 12}, "load without byte counting"},
+    {{"hist", no_argument, NULL, 13}, "load with frame size histogram"},
+    {{"filter", required_argument, NULL, 14}, "load with IPv4 source denylist from file", "<file>"},
+    {{"sample", required_argument, NULL, 15}, "account only 1 in N packets, scaled by N", "<N>"},
+    {{"tunnels", required_argument, NULL, 16}, "load with VXLAN/GRE decap for endpoints from file", "<file>"},
+    {{"rules", required_argument, NULL, 17}, "load with multi-field classifier rules from file", "<file>"},
+    {{"filter-size", required_argument, NULL, 18}, "resize IPv4 denylist table, keeps its entries", "<num>"},
+    {{"bloom-fp", required_argument, NULL, 23}, "check --filter addrs in a bloom filter of this FP rate first", "<rate>"},
+
+    {{0, 0, NULL, 0}},
 };
 
-int pin_maps_in_bpf_object(struct bpf_object *bpf_obj, struct config *cfg)
+int pin_maps_in_bpf_object(struct bpf_object *bpf_obj, struct config *cfg, const char *mapname)
 {
     char map_filename[PATH_MAX];
     char pin_dir[PATH_MAX];
@@ -45,7 +72,7 @@ int pin_maps_in_bpf_object(struct bpf_object *bpf_obj, struct config *cfg)
     }
 
     len = snprintf(map_filename, PATH_MAX, "%s/%s/%s",
-                   cfg->pin_basedir, cfg->netif_name, cfg->mapname);
+                   cfg->pin_basedir, cfg->netif_name, mapname);
     if (len < 0)
     {
         fprintf(stderr, "ERR: creating map_name\n");
@@ -60,7 +87,7 @@ int pin_maps_in_bpf_object(struct bpf_object *bpf_obj, struct config *cfg)
                pin_dir);
 
         /* Basically calls unlink(3) on map_filename */
-        err = bpf_object__unpin_maps(bpf_obj, pin_dir);
+        err = unpin_bpf_obj_maps(bpf_obj, pin_dir);
         if (err)
         {
             fprintf(stderr, "ERR: UNpinning maps in %s failed(%d): %s\n", pin_dir, err, strerror(-err));
@@ -69,8 +96,8 @@ int pin_maps_in_bpf_object(struct bpf_object *bpf_obj, struct config *cfg)
     }
     printf(" - Pinning maps in %s/\n", pin_dir);
 
-    /* This will pin all maps in our bpf_object */
-    err = bpf_object__pin_maps(bpf_obj, pin_dir);
+    /* This will pin all maps in our bpf_object but the inner map templates */
+    err = pin_bpf_obj_maps(bpf_obj, pin_dir);
     if (err)
     {
         fprintf(stderr, "ERR: pinning map failed(%d): %s\n", err, strerror(-err));
@@ -92,107 +119,356 @@ int find_map_fd(struct bpf_object *bpf_obj, const char *mapname)
     return bpf_map__fd(map);
 }
 
-int check_map_fd_info(int map_fd, struct bpf_map_info *info, struct bpf_map_info *exp)
+struct record
+{
+    __u64 ts;
+    struct datarec total;
+};
+
+struct stats_record
 {
-    __u32 info_len = sizeof(*info);
+    struct record stats[XDP_ACTION_MAX];
+    struct record tc[TC_STAT_MAX];
+    struct record filter[FILTER_STAT_MAX];
+    __u64 hist[SIZE_HIST_BUCKETS];
+};
 
-    if (map_fd < 0)
+struct stats_ctx
+{
+    int map_fd;
+    __u32 map_type;
+    int tc_map_fd;
+    int filter_map_fd;
+    int hist_map_fd;
+    int rxq_map_fd;
+    __u32 nr_rxq;
+    bool *cpu_online;
+    int nr_cpus;
+    int netif_idx;
+    int run_stats_fd;
+    struct ts_ring *ring;
+    struct lb_stats *lb;
+    struct tunnel_stats *tun;
+    struct classifier_stats *cls;
+};
+
+void map_get_value_array(int fd, __u32 key, struct datarec *value)
+{
+    if (bpf_map_lookup_elem(fd, &key, value))
     {
-        return EXIT_FAIL;
+        fprintf(stderr, "ERR: bpf map lookup elem failed: key(0x%X)\n", key);
     }
+}
 
-    int err = bpf_obj_get_info_by_fd(map_fd, info, &info_len);
-    if (err)
+void map_get_value_percpu_array(int fd, __u32 key, struct datarec *value)
+{
+    int nr_cpus = libbpf_num_possible_cpus();
+    struct datarec values[nr_cpus];
+
+    if (bpf_map_lookup_elem(fd, &key, values))
     {
-        fprintf(stderr, "ERR: %s() cant't get info: %s\n", __func__, strerror(-err));
-        return EXIT_FAIL_BPF;
+        fprintf(stderr, "ERR: bpf map lookup elem failed: key(0x%X)\n", key);
+        return;
     }
-
-    if (exp->key_size && exp->key_size != info->key_size)
+    for (int cpu = 0; cpu < nr_cpus; cpu++)
     {
-        fprintf(stderr, "ERR: %s() Map key size mismatch, expect(%d), found(%d)\n", __func__, exp->key_size, info->key_size);
-        return EXIT_FAIL;
+        value->rx_pkts += values[cpu].rx_pkts;
+        value->rx_bytes += values[cpu].rx_bytes;
     }
+}
 
-    if (exp->value_size && exp->value_size != info->value_size)
+bool map_collect(int fd, __u32 map_type, __u32 key, struct record *rec)
+{
+    struct datarec value = {0};
+    rec->ts = gettime();
+
+    switch (map_type)
     {
-        fprintf(stderr, "ERR: %s() map value size mismatch, expect(%d), found(%d)\n", __func__, exp->value_size, info->value_size);
-        return EXIT_FAIL;
+    case BPF_MAP_TYPE_ARRAY:
+        map_get_value_array(fd, key, &value);
+        break;
+    case BPF_MAP_TYPE_PERCPU_ARRAY:
+        map_get_value_percpu_array(fd, key, &value);
+        break;
+    case BPF_MAP_TYPE_PERCPU_HASH:
+    default:
+        fprintf(stderr, "ERR: unknown map_type(%u) can't handle\n", map_type);
+        return false;
+        break;
     }
 
-    if (exp->max_entries && exp->max_entries != info->max_entries)
+    rec->total.rx_pkts = value.rx_pkts;
+    rec->total.rx_bytes = value.rx_bytes;
+    return true;
+}
+
+/* Per-CPU buckets, summed here so the datapath never needs atomics */
+void hist_collect(struct stats_ctx *ctx, __u64 *hist)
+{
+    __u64 values[ctx->nr_cpus];
+    for (__u32 key = 0; key < SIZE_HIST_BUCKETS; key++)
     {
-        fprintf(stderr, "ERR: %s() map max entries mismatch, expect(%d), found(%d)\n", __func__, exp->max_entries, info->max_entries);
-        return EXIT_FAIL;
+        hist[key] = 0;
+        if (bpf_map_lookup_elem(ctx->hist_map_fd, &key, values))
+        {
+            continue;
+        }
+        for (int cpu = 0; cpu < ctx->nr_cpus; cpu++)
+        {
+            hist[key] += values[cpu];
+        }
     }
+}
 
-    if (exp->type && exp->type != info->type)
+void hist_print(__u64 *hist, __u64 *prev)
+{
+    __u64 total = 0;
+    for (__u32 key = 0; key < SIZE_HIST_BUCKETS; key++)
     {
-        fprintf(stderr, "ERR: %s() map type mismatch, expect(%u), found(%u)\n", __func__, exp->type, info->type);
-        return EXIT_FAIL;
+        total += hist[key] - prev[key];
+    }
+    if (!total)
+    {
+        return;
     }
 
-    return 0;
+    printf("%-12s", "SIZE_HIST");
+    for (__u32 key = 0; key < SIZE_HIST_BUCKETS; key++)
+    {
+        double share = (double)(hist[key] - prev[key]) * 100 / total;
+        if (key < SIZE_HIST_BUCKETS - 1)
+        {
+            printf(" <%u:%.1f%%", SIZE_HIST_BOUND(key), share);
+        }
+        else
+        {
+            printf(" >=%u:%.1f%%", SIZE_HIST_BOUND(key - 1), share);
+        }
+    }
+    printf("\n");
 }
 
-struct record
+/* Cumulative packets per RX queue and CPU, pkts[rxq * nr_cpus + cpu] */
+struct rxq_record
 {
     __u64 ts;
-    struct datarec total;
+    __u64 *pkts;
 };
 
-struct stats_record
+void rxq_collect(struct stats_ctx *ctx, struct rxq_record *rec)
 {
-    struct record stats[1];
-};
+    struct datarec values[ctx->nr_cpus];
+
+    rec->ts = gettime();
+    for (__u32 key = 0; key < RXQ_MAX; key++)
+    {
+        __u64 *pkts = &rec->pkts[key * ctx->nr_cpus];
+        if (bpf_map_lookup_elem(ctx->rxq_map_fd, &key, values))
+        {
+            memset(pkts, 0, sizeof(*pkts) * ctx->nr_cpus);
+            continue;
+        }
+        for (int cpu = 0; cpu < ctx->nr_cpus; cpu++)
+        {
+            pkts[cpu] = values[cpu].rx_pkts;
+        }
+    }
+}
 
-#define NANOSEC_PER_SEC 1000000000
-__u64 gettime()
+/* RX queues the device has right now, 0 if sysfs can't tell */
+__u32 netif_rx_queues(const char *ifname)
 {
-    struct timespec t;
-    int res = clock_gettime(CLOCK_MONOTONIC, &t);
-    if (res < 0)
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/queues", ifname);
+    DIR *dir = opendir(path);
+    if (!dir)
     {
-        fprintf(stderr, "ERR: get time failed(%d)\n", res);
-        exit(EXIT_FAIL);
+        return 0;
     }
-    return (__u64)t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
+
+    __u32 nr = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)))
+    {
+        if (!strncmp(ent->d_name, "rx-", 3))
+        {
+            nr++;
+        }
+    }
+    closedir(dir);
+    return nr;
 }
 
-void map_get_value_array(int fd, __u32 key, struct datarec *value)
+/* Parse the "0-3,6" list in /sys/devices/system/cpu/online, all CPUs if it can't be read */
+void cpu_online_read(bool *online, int nr_cpus)
 {
-    if (bpf_map_lookup_elem(fd, &key, value))
+    FILE *fp = fopen("/sys/devices/system/cpu/online", "r");
+    if (!fp)
     {
-        fprintf(stderr, "ERR: bpf map lookup elem failed: key(0x%X)\n", key);
+        memset(online, 1, sizeof(*online) * nr_cpus);
+        return;
     }
+
+    memset(online, 0, sizeof(*online) * nr_cpus);
+    unsigned int start, end;
+    while (fscanf(fp, "%u", &start) == 1)
+    {
+        end = start;
+        int c = fgetc(fp);
+        if (c == '-')
+        {
+            if (fscanf(fp, "%u", &end) != 1)
+            {
+                break;
+            }
+            c = fgetc(fp);
+        }
+        for (unsigned int cpu = start; cpu <= end && cpu < (unsigned int)nr_cpus; cpu++)
+        {
+            online[cpu] = true;
+        }
+        if (c != ',')
+        {
+            break;
+        }
+    }
+    fclose(fp);
 }
 
-bool map_collect(int fd, __u32 map_type, __u32 key, struct record *rec)
+void skew_print(const char *name, __u64 max, __u64 sum, __u32 nr)
 {
-    struct datarec value;
-    rec->ts = gettime();
+    if (!nr || !sum)
+    {
+        return;
+    }
+    double mean = (double)sum / nr;
+    printf("%-12s max/mean %.2f over %u\n", name, max / mean, nr);
+}
 
-    switch (map_type)
+/*
+ * One line per RX queue of the device (and any other that ever saw
+ * traffic), with the CPU that served most of it, then the max/mean skew
+ * across queues and across online CPUs. Idle ones count towards the
+ * mean, that is exactly the imbalance to find.
+ */
+void rxq_print(struct stats_ctx *ctx, struct rxq_record *rec, struct rxq_record *prev)
+{
+    double period = (double)(rec->ts - prev->ts) / NANOSEC_PER_SEC;
+    if (period <= 0)
     {
-    case BPF_MAP_TYPE_ARRAY:
-        map_get_value_array(fd, key, &value);
-        break;
-    case BPF_MAP_TYPE_PERCPU_HASH:
-    default:
-        fprintf(stderr, "ERR: unknown map_type(%u) can't handle\n", map_type);
-        return false;
-        break;
+        return;
     }
 
-    rec->total.rx_pkts = value.rx_pkts;
-    return true;
+    __u64 cpu_pkts[ctx->nr_cpus];
+    bool cpu_seen[ctx->nr_cpus];
+    memset(cpu_pkts, 0, sizeof(cpu_pkts));
+    for (int cpu = 0; cpu < ctx->nr_cpus; cpu++)
+    {
+        cpu_seen[cpu] = ctx->cpu_online && ctx->cpu_online[cpu];
+    }
+
+    __u64 rxq_max = 0, rxq_sum = 0;
+    __u32 nr_rxq = 0;
+    for (__u32 key = 0; key < RXQ_MAX; key++)
+    {
+        __u64 *pkts = &rec->pkts[key * ctx->nr_cpus],
+              *prev_pkts = &prev->pkts[key * ctx->nr_cpus];
+        __u64 total = 0, seen = 0, top = 0;
+        int top_cpu = 0;
+
+        for (int cpu = 0; cpu < ctx->nr_cpus; cpu++)
+        {
+            __u64 delta = pkts[cpu] - prev_pkts[cpu];
+            total += delta;
+            seen += pkts[cpu];
+            cpu_pkts[cpu] += delta;
+            cpu_seen[cpu] |= pkts[cpu] != 0;
+            if (delta > top)
+            {
+                top = delta;
+                top_cpu = cpu;
+            }
+        }
+        if (!seen && key >= ctx->nr_rxq)
+        {
+            continue;
+        }
+
+        nr_rxq++;
+        rxq_sum += total;
+        if (total > rxq_max)
+        {
+            rxq_max = total;
+        }
+
+        char name[16];
+        snprintf(name, sizeof(name), "RXQ %u", key);
+        printf("%-12s %lld pkts (%'10.0f pps)", name, total, total / period);
+        if (total)
+        {
+            printf(" top cpu %d (%.0f%%)", top_cpu, (double)top * 100 / total);
+        }
+        printf("\n");
+    }
+    skew_print("RXQ skew", rxq_max, rxq_sum, nr_rxq);
+
+    __u64 cpu_max = 0, cpu_sum = 0;
+    __u32 nr_cpu = 0;
+    for (int cpu = 0; cpu < ctx->nr_cpus; cpu++)
+    {
+        if (!cpu_seen[cpu])
+        {
+            continue;
+        }
+        nr_cpu++;
+        cpu_sum += cpu_pkts[cpu];
+        if (cpu_pkts[cpu] > cpu_max)
+        {
+            cpu_max = cpu_pkts[cpu];
+        }
+    }
+    skew_print("CPU skew", cpu_max, cpu_sum, nr_cpu);
+}
+
+/* Cost of whatever XDP prog is attached, from kernel run-time stats */
+void run_stats_print(struct prog_run_stats *run, struct prog_run_stats *prev)
+{
+    if (!run->prog_id || run->prog_id != prev->prog_id || run->run_cnt <= prev->run_cnt)
+    {
+        return;
+    }
+
+    __u64 cnt = run->run_cnt - prev->run_cnt;
+    __u64 ns = run->run_time_ns - prev->run_time_ns;
+    double cpu_share = (double)ns * 100 / (run->ts - prev->ts);
+    long nr_online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("%-12s prog id %u avg %'.1f ns/pkt, %.2f%% of one CPU (%.2f%% of %ld)\n",
+           "XDP_COST", run->prog_id, (double)ns / cnt, cpu_share, cpu_share / nr_online, nr_online);
 }
 
-void stats_print(__u32 key, struct stats_record *stats_rec, struct stats_record *stats_prev)
+void stats_collect(struct stats_ctx *ctx, struct stats_record *stats_rec)
 {
-    struct record *rec = &stats_rec->stats[0],
-                  *prev = &stats_prev->stats[0];
+    for (__u32 key = 0; key < XDP_ACTION_MAX; key++)
+    {
+        map_collect(ctx->map_fd, ctx->map_type, key, &stats_rec->stats[key]);
+    }
+    for (__u32 key = 0; ctx->tc_map_fd >= 0 && key < TC_STAT_MAX; key++)
+    {
+        map_collect(ctx->tc_map_fd, BPF_MAP_TYPE_ARRAY, key, &stats_rec->tc[key]);
+    }
+    for (__u32 key = 0; ctx->filter_map_fd >= 0 && key < FILTER_STAT_MAX; key++)
+    {
+        map_collect(ctx->filter_map_fd, BPF_MAP_TYPE_PERCPU_ARRAY, key, &stats_rec->filter[key]);
+    }
+    if (ctx->hist_map_fd >= 0)
+    {
+        hist_collect(ctx, stats_rec->hist);
+    }
+}
 
+void record_print(const char *name, struct record *rec, struct record *prev)
+{
     __u64 tmp_period = rec->ts - prev->ts;
     double period = 0;
     if (tmp_period > 0)
@@ -207,27 +483,204 @@ void stats_print(__u32 key, struct stats_record *stats_rec, struct stats_record
 
     __u64 pkts = rec->total.rx_pkts - prev->total.rx_pkts;
     double pps = (double)pkts / period;
+    __u64 bytes = rec->total.rx_bytes - prev->total.rx_bytes;
+    double mbps = (double)bytes * 8 / period / 1000000;
+
+    printf("%-12s %lld pkts (%'10.0f pps) %'11.2f Mbit/s period(%f)\n", name, pkts, pps, mbps, period);
+}
+
+static const char *tc_stat_names[TC_STAT_MAX] = {
+    [TC_STAT_META] = "TC_META",
+    [TC_STAT_REPARSE] = "TC_REPARSE",
+};
+
+void stats_print(struct stats_ctx *ctx, struct stats_record *stats_rec, struct stats_record *stats_prev)
+{
+    for (__u32 key = 0; key < XDP_ACTION_MAX; key++)
+    {
+        record_print(action2str(key), &stats_rec->stats[key], &stats_prev->stats[key]);
+    }
+    for (__u32 key = 0; ctx->filter_map_fd >= 0 && key < FILTER_STAT_MAX; key++)
+    {
+        record_print(filter_stat2str(key), &stats_rec->filter[key], &stats_prev->filter[key]);
+    }
+    /* TC_REPARSE means the XDP metadata handoff did not happen */
+    for (__u32 key = 0; ctx->tc_map_fd >= 0 && key < TC_STAT_MAX; key++)
+    {
+        record_print(tc_stat_names[key], &stats_rec->tc[key], &stats_prev->tc[key]);
+    }
+    hist_print(stats_rec->hist, stats_prev->hist);
+}
+
+/* Only plain stores into the shared mapping, the kernel writes it back */
+void stats_append(struct ts_ring *ring, struct stats_record *stats_rec)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
 
-    printf("%-12s %lld pkts (%'10.0f pps) period(%f)\n", action2str(key), pkts, pps, period);
+    struct ts_ring_entry *entry = ts_ring_begin(ring);
+    entry->ts = (__u64)t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
+    for (__u32 key = 0; key < XDP_ACTION_MAX; key++)
+    {
+        entry->act[key].pkts = stats_rec->stats[key].total.rx_pkts;
+        entry->act[key].bytes = stats_rec->stats[key].total.rx_bytes;
+    }
+    ts_ring_commit(ring, entry);
+}
+
+static volatile sig_atomic_t stats_stop;
+
+static void stats_stop_handler(int sig)
+{
+    stats_stop = 1;
 }
 
-void stats_poll(int map_fd, __u32 map_type, int interval)
+/* Polls until SIGINT/SIGTERM, so the caller gets to release what it holds */
+void stats_poll(struct stats_ctx *ctx, int interval)
 {
     setlocale(LC_NUMERIC, "en_US");
+    signal(SIGINT, stats_stop_handler);
+    signal(SIGTERM, stats_stop_handler);
+
+    struct rxq_record rxq[2] = {0}, *rxq_rec = NULL, *rxq_prev = NULL;
+    if (ctx->rxq_map_fd >= 0)
+    {
+        rxq[0].pkts = calloc(RXQ_MAX * ctx->nr_cpus, sizeof(__u64));
+        rxq[1].pkts = calloc(RXQ_MAX * ctx->nr_cpus, sizeof(__u64));
+        ctx->cpu_online = calloc(ctx->nr_cpus, sizeof(bool));
+        if (rxq[0].pkts && rxq[1].pkts && ctx->cpu_online)
+        {
+            cpu_online_read(ctx->cpu_online, ctx->nr_cpus);
+            rxq_rec = &rxq[0];
+            rxq_prev = &rxq[1];
+            rxq_collect(ctx, rxq_rec);
+        }
+    }
 
-    __u32 key = XDP_PASS;
     struct stats_record record = {0};
-    map_collect(map_fd, map_type, key, &record.stats[0]);
+    stats_collect(ctx, &record);
+    if (ctx->lb)
+    {
+        lb_stats_collect(ctx->lb);
+    }
+    if (ctx->tun)
+    {
+        tunnel_stats_collect(ctx->tun);
+    }
+    if (ctx->cls)
+    {
+        classifier_stats_collect(ctx->cls);
+    }
     usleep(1000000 / 4);
 
+    struct prog_run_stats run = {.prog_fd = -1}, run_prev;
+    if (ctx->run_stats_fd >= 0)
+    {
+        xdp_prog_run_stats(ctx->netif_idx, &run);
+    }
+
     struct stats_record prev;
-    while (1)
+    struct lb_stats lb_prev;
+    struct tunnel_stats tun_prev;
+    struct classifier_stats cls_prev;
+    while (!stats_stop)
     {
         prev = record;
-        map_collect(map_fd, map_type, key, &record.stats[0]);
-        stats_print(key, &record, &prev);
+        stats_collect(ctx, &record);
+        stats_print(ctx, &record, &prev);
+        if (ctx->run_stats_fd >= 0)
+        {
+            run_prev = run;
+            if (!xdp_prog_run_stats(ctx->netif_idx, &run))
+            {
+                run_stats_print(&run, &run_prev);
+            }
+        }
+        if (rxq_rec)
+        {
+            struct rxq_record *tmp = rxq_prev;
+            rxq_prev = rxq_rec;
+            rxq_rec = tmp;
+            rxq_collect(ctx, rxq_rec);
+            rxq_print(ctx, rxq_rec, rxq_prev);
+        }
+        if (ctx->lb)
+        {
+            lb_prev = *ctx->lb;
+            lb_stats_collect(ctx->lb);
+            lb_stats_print(ctx->lb, &lb_prev);
+        }
+        if (ctx->tun)
+        {
+            tun_prev = *ctx->tun;
+            tunnel_stats_collect(ctx->tun);
+            tunnel_stats_print(ctx->tun, &tun_prev);
+        }
+        if (ctx->cls)
+        {
+            cls_prev = *ctx->cls;
+            classifier_stats_collect(ctx->cls);
+            classifier_stats_print(ctx->cls, &cls_prev);
+        }
+        printf("\n");
+        if (ctx->ring)
+        {
+            stats_append(ctx->ring, &record);
+        }
         sleep(interval);
     }
+
+    if (run.prog_fd >= 0)
+    {
+        close(run.prog_fd);
+    }
+    free(rxq[0].pkts);
+    free(rxq[1].pkts);
+    free(ctx->cpu_online);
+}
+
+/*
+ * Without --pinmap the maps behind an already attached prog get loaded, but
+ * a feature built out of its .rodata never reads them.
+ */
+static int check_attached_features(const struct config *cfg)
+{
+    struct xdp_features features;
+    int err = xdp_prog_rodata(cfg->netif_idx, &features, sizeof(features));
+    if (err)
+    {
+        fprintf(stderr, "WARN: read features of attached prog failed(%d): %s\n", -err, strerror(-err));
+        return EXIT_OK;
+    }
+
+    const char *missing = NULL;
+    if (cfg->filter_file[0] && !features.filter)
+    {
+        missing = "--filter";
+    }
+    else if (cfg->filter_file[0] && cfg->bloom_fp > 0 && !features.filter_bloom)
+    {
+        missing = "--bloom-fp";
+    }
+    else if (cfg->tun_file[0] && !features.tunnel_decap)
+    {
+        missing = "--tunnels";
+    }
+    else if (cfg->rules_file[0] && !features.classifier)
+    {
+        missing = "--rules";
+    }
+    else if (cfg->lb_conf[0] && !features.lb)
+    {
+        missing = "--lb-conf";
+    }
+
+    if (missing)
+    {
+        fprintf(stderr, "ERR: attached prog was loaded without %s, reload it with --pinmap %s\n", missing, missing);
+        return EXIT_ACQUIRE_OPT_FAIL;
+    }
+    return EXIT_OK;
 }
 
 int main(int argc, char *argv[])
@@ -242,6 +695,7 @@ int main(int argc, char *argv[])
     strncpy(cfg.obj_filename, default_bpf_obj_filename, sizeof(cfg.obj_filename));
     strncpy(cfg.pin_basedir, default_pin_basedir, sizeof(cfg.pin_basedir));
     strncpy(cfg.mapname, default_map_name, sizeof(cfg.mapname));
+    strncpy(cfg.tc_filename, default_tc_filename, sizeof(cfg.tc_filename));
 
     parse_cmd_args(
         argc,
@@ -256,11 +710,22 @@ int main(int argc, char *argv[])
     }
     if (cfg.do_unload)
     {
-        return xdp_link_detach(cfg.netif_idx, cfg.xdp_flags, 0);
+        int tc_err = tc_link_detach(cfg.netif_idx);
+        int err = xdp_link_detach(cfg.netif_idx, cfg.xdp_flags, 0);
+        return err ? err : tc_err;
     }
 
     if (cfg.need_pin)
     {
+        /* Switches end up in .rodata, disabled features cost nothing */
+        struct xdp_features features;
+        const char *stub_maps[XDP_FEATURES_STUB_MAX + 1];
+        xdp_features_from_cfg(&cfg, &features);
+        xdp_features_stub_maps(&features, stub_maps);
+        cfg.rodata = &features;
+        cfg.rodata_sz = sizeof(features);
+        cfg.stub_maps = stub_maps;
+
         struct bpf_object *bpf_obj = load_bpf_and_xdp_attach(&cfg);
         if (!bpf_obj)
         {
@@ -269,12 +734,70 @@ int main(int argc, char *argv[])
 
         printf("Success: Loaded BPF-obj(%s), used section(%s)\n", cfg.obj_filename, cfg.progsec);
 
-        int err = pin_maps_in_bpf_object(bpf_obj, &cfg);
+        int err = pin_maps_in_bpf_object(bpf_obj, &cfg, cfg.mapname);
         if (err)
         {
             fprintf(stderr, "ERR: pin map failed(%d): %s\n", err, strerror(-err));
             return EXIT_FAIL_BPF;
         }
+
+        /* TC consumes the metadata xdp_stat_prog leaves, attach them as a pair */
+        struct bpf_object *tc_obj = load_bpf_and_tc_attach(&cfg);
+        if (!tc_obj)
+        {
+            xdp_link_detach(cfg.netif_idx, cfg.xdp_flags, 0);
+            return EXIT_FAIL_BPF;
+        }
+
+        printf("Success: Loaded TC BPF-obj(%s)\n", cfg.tc_filename);
+
+        err = pin_maps_in_bpf_object(tc_obj, &cfg, tc_stat_map_name);
+        if (err)
+        {
+            fprintf(stderr, "ERR: pin TC map failed(%d): %s\n", err, strerror(-err));
+            return EXIT_FAIL_BPF;
+        }
+
+        if (cfg.filter_size)
+        {
+            err = filter_resize(&cfg);
+            if (err)
+            {
+                return err;
+            }
+        }
+
+        if (cfg.filter_file[0])
+        {
+            err = filter_load_file(&cfg);
+            if (err)
+            {
+                return err;
+            }
+        }
+
+        if (cfg.tun_file[0])
+        {
+            err = tunnel_load_file(&cfg);
+            if (err)
+            {
+                return err;
+            }
+        }
+
+        if (cfg.rules_file[0])
+        {
+            err = classifier_load_file(&cfg);
+            if (err)
+            {
+                return err;
+            }
+        }
+
+        if (cfg.lb_conf[0])
+        {
+            return lb_apply_conf(&cfg);
+        }
         return EXIT_OK;
     }
 
@@ -299,7 +822,97 @@ int main(int argc, char *argv[])
         return err;
     }
 
-    stats_poll(map_fd, info.type, 2);
+    err = check_attached_features(&cfg);
+    if (err)
+    {
+        return err;
+    }
+
+    struct ts_ring ring = {.fd = -1};
+    if (cfg.ts_filename[0])
+    {
+        err = ts_ring_open(&ring, cfg.ts_filename, cfg.ts_entries, cfg.netif_name, cfg.netif_idx);
+        if (err)
+        {
+            fprintf(stderr, "ERR: open ts file(%s) failed(%d): %s\n", cfg.ts_filename, err, strerror(-err));
+            return EXIT_FAIL;
+        }
+    }
 
+    if (cfg.filter_size)
+    {
+        err = filter_resize(&cfg);
+        if (err)
+        {
+            return err;
+        }
+    }
+
+    if (cfg.filter_file[0])
+    {
+        err = filter_load_file(&cfg);
+        if (err)
+        {
+            return err;
+        }
+    }
+
+    if (cfg.tun_file[0])
+    {
+        err = tunnel_load_file(&cfg);
+        if (err)
+        {
+            return err;
+        }
+    }
+
+    if (cfg.rules_file[0])
+    {
+        err = classifier_load_file(&cfg);
+        if (err)
+        {
+            return err;
+        }
+    }
+
+    if (cfg.lb_conf[0])
+    {
+        err = lb_apply_conf(&cfg);
+        if (err)
+        {
+            return err;
+        }
+    }
+
+    struct lb_stats lb;
+    struct tunnel_stats tun;
+    struct classifier_stats cls;
+    struct stats_ctx ctx = {
+        .map_fd = map_fd,
+        .map_type = info.type,
+        .tc_map_fd = open_bpf_map_file_by_name(&cfg, tc_stat_map_name, NULL),
+        .filter_map_fd = open_bpf_map_file_by_name(&cfg, "xdp_filter_stat_map", NULL),
+        .hist_map_fd = open_bpf_map_file_by_name(&cfg, "xdp_size_hist_map", NULL),
+        .rxq_map_fd = open_bpf_map_file_by_name(&cfg, "xdp_rxq_stat_map", NULL),
+        .nr_rxq = netif_rx_queues(cfg.netif_name),
+        .nr_cpus = libbpf_num_possible_cpus(),
+        .netif_idx = cfg.netif_idx,
+        .run_stats_fd = enable_prog_run_stats(),
+        .ring = cfg.ts_filename[0] ? &ring : NULL,
+        .lb = lb_stats_open(&cfg, &lb) ? NULL : &lb,
+        .tun = tunnel_stats_open(&cfg, &tun) ? NULL : &tun,
+        .cls = classifier_stats_open(&cfg, &cls) ? NULL : &cls,
+    };
+
+    stats_poll(&ctx, 2);
+
+    if (ctx.run_stats_fd >= 0)
+    {
+        close(ctx.run_stats_fd);
+    }
+    if (ctx.ring)
+    {
+        ts_ring_close(ctx.ring);
+    }
     return EXIT_OK;
 }
\ No newline at end of file
@@ -0,0 +1,195 @@
+#ifndef __ONE_PARSING_HELPERS_H
+#define __ONE_PARSING_HELPERS_H
+
+#include <stddef.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <bpf/bpf_endian.h>
+
+/* Tracks the next unparsed header between the parse_* calls */
+struct hdr_cursor
+{
+	void *pos;
+};
+
+static __always_inline int parse_ethhdr(struct hdr_cursor *nh, void *data_end, struct ethhdr **ethhdr)
+{
+	struct ethhdr *eth = nh->pos;
+	if ((void *)(eth + 1) > data_end)
+	{
+		return -1;
+	}
+
+	nh->pos = eth + 1;
+	*ethhdr = eth;
+	return eth->h_proto;
+}
+
+static __always_inline int parse_iphdr(struct hdr_cursor *nh, void *data_end, struct iphdr **iphdr)
+{
+	struct iphdr *iph = nh->pos;
+	if ((void *)(iph + 1) > data_end)
+	{
+		return -1;
+	}
+
+	int hdrsize = iph->ihl * 4;
+	if (hdrsize < sizeof(*iph) || nh->pos + hdrsize > data_end)
+	{
+		return -1;
+	}
+
+	nh->pos += hdrsize;
+	*iphdr = iph;
+	return iph->protocol;
+}
+
+static __always_inline int parse_udphdr(struct hdr_cursor *nh, void *data_end, struct udphdr **udphdr)
+{
+	struct udphdr *udph = nh->pos;
+	if ((void *)(udph + 1) > data_end)
+	{
+		return -1;
+	}
+
+	nh->pos = udph + 1;
+	*udphdr = udph;
+	return 0;
+}
+
+static __always_inline int parse_tcphdr(struct hdr_cursor *nh, void *data_end, struct tcphdr **tcphdr)
+{
+	struct tcphdr *tcph = nh->pos;
+	if ((void *)(tcph + 1) > data_end)
+	{
+		return -1;
+	}
+
+	int hdrsize = tcph->doff * 4;
+	if (hdrsize < sizeof(*tcph) || nh->pos + hdrsize > data_end)
+	{
+		return -1;
+	}
+
+	nh->pos += hdrsize;
+	*tcphdr = tcph;
+	return 0;
+}
+
+struct vxlanhdr
+{
+	__be32 vx_flags;
+	__be32 vx_vni;
+};
+
+struct grehdr
+{
+	__be16 flags;
+	__be16 proto;
+};
+
+#define GRE_CSUM 0x8000
+#define GRE_ROUTING 0x4000
+#define GRE_KEY 0x2000
+#define GRE_SEQ 0x1000
+#define GRE_VERSION 0x0007
+
+#ifndef ETH_P_TEB
+#define ETH_P_TEB 0x6558
+#endif
+
+#ifndef IP_MF
+#define IP_MF 0x2000
+#define IP_OFFSET 0x1fff
+#endif
+
+struct flow_v4
+{
+	struct ethhdr *eth;
+	struct iphdr *iph;
+	__be16 sport;
+	__be16 dport;
+	__u16 l3_off;
+	__u16 l4_off;
+	__u8 tcp_flags;
+	__u8 frag;
+};
+
+/*
+ * Returns the IP protocol, ports are only filled in for TCP and UDP.
+ * Fragments leave them zeroed: only the first one carries the L4
+ * header, so callers must not key on ports when frag is set.
+ */
+static __always_inline int parse_flow_v4(void *data, void *data_end, struct flow_v4 *flow)
+{
+	struct hdr_cursor nh = {.pos = data};
+
+	if (parse_ethhdr(&nh, data_end, &flow->eth) != bpf_htons(ETH_P_IP))
+	{
+		return -1;
+	}
+	flow->l3_off = nh.pos - data;
+
+	int proto = parse_iphdr(&nh, data_end, &flow->iph);
+	if (proto < 0)
+	{
+		return -1;
+	}
+	flow->l4_off = nh.pos - data;
+	flow->sport = 0;
+	flow->dport = 0;
+	flow->tcp_flags = 0;
+	flow->frag = !!(flow->iph->frag_off & bpf_htons(IP_MF | IP_OFFSET));
+	if (flow->frag)
+	{
+		return proto;
+	}
+
+	if (proto == IPPROTO_TCP)
+	{
+		struct tcphdr *tcph;
+		if (parse_tcphdr(&nh, data_end, &tcph))
+		{
+			return -1;
+		}
+		flow->sport = tcph->source;
+		flow->dport = tcph->dest;
+		/* FIN..CWR, the byte after doff */
+		flow->tcp_flags = ((__u8 *)tcph)[13];
+	}
+	else if (proto == IPPROTO_UDP)
+	{
+		struct udphdr *udph;
+		if (parse_udphdr(&nh, data_end, &udph))
+		{
+			return -1;
+		}
+		flow->sport = udph->source;
+		flow->dport = udph->dest;
+	}
+	return proto;
+}
+
+/* murmur3 finalizer over the IPv4 5-tuple, ports packed as sport << 16 | dport */
+static __always_inline __u32 flow_hash_v4(__u32 saddr, __u32 daddr, __u32 ports, __u8 proto)
+{
+	__u32 h = saddr ^ (daddr * 0x85ebca6b) ^ (ports * 0xc2b2ae35) ^ proto;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static __always_inline __u32 flow_v4_hash(const struct flow_v4 *flow)
+{
+	return flow_hash_v4(flow->iph->saddr, flow->iph->daddr,
+			    ((__u32)flow->sport << 16) | flow->dport, flow->iph->protocol);
+}
+
+#endif
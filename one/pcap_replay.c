@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <locale.h>
+#include <pthread.h>
+#include <pcap.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+
+#include "../global/common_define.h"
+#include "../global/cmd_args.h"
+#include "../global/xdp_helper.h"
+#include "common_user_kern.h"
+#include "filter_user.h"
+#include "features_user.h"
+#include "classifier_user.h"
+
+static const char *default_bpf_obj_filename = "xdp_prog_kern.o";
+static const __u32 default_replay_threads = 1;
+static const __u32 default_replay_batch = 64;
+static const __u32 default_replay_repeat = 1;
+
+struct option_wrapper wrappers[] = {
+    {{"pcap", required_argument, NULL, 19}, "capture to replay, Ethernet link type only", "<file>", .required = true},
+    {{"filename", required_argument, NULL, 2}, "XDP object to run the frames through", "<file>"},
+    {{"progsec", required_argument, NULL, 1}, "program section, first program by default", "<sec>"},
+    {{"threads", required_argument, NULL, 20}, "worker threads", "<num>"},
+    {{"batch", required_argument, NULL, 21}, "frames a worker takes at a time", "<num>"},
+    {{"repeat", required_argument, NULL, 22}, "runs per frame, the kernel reports the mean", "<num>"},
+
+    {{"no-bytes", no_argument, NULL, 12}, "run without byte counting"},
+    {{"hist", no_argument, NULL, 13}, "run with frame size histogram"},
+    {{"filter", required_argument, NULL, 14}, "run with IPv4 source denylist from file", "<file>"},
+    {{"sample", required_argument, NULL, 15}, "account only 1 in N packets, scaled by N", "<N>"},
+    {{"rules", required_argument, NULL, 17}, "run with multi-field classifier rules from file", "<file>"},
+    {{"bloom-fp", required_argument, NULL, 23}, "check --filter addrs in a bloom filter of this FP rate first", "<rate>"},
+
+    {{0, 0, NULL, 0}},
+};
+
+struct frame
+{
+    const __u8 *data;
+    __u32 len;
+};
+
+struct capture
+{
+    __u8 *buf;
+    struct frame *frames;
+    __u64 nr;
+    __u64 bytes;
+    __u64 skipped;
+};
+
+struct replay_result
+{
+    __u64 verdict[XDP_ACTION_MAX];
+    __u64 verdict_bytes[XDP_ACTION_MAX];
+    __u64 unknown;
+    __u64 errors;
+    __u64 run_ns;
+};
+
+struct replay_worker
+{
+    pthread_t tid;
+    int prog_fd;
+    __u32 repeat;
+    __u32 batch;
+    const struct capture *cap;
+    __u64 *next;
+    struct replay_result res;
+};
+
+/* Keeps the whole capture in one buffer so workers never touch libpcap */
+static int capture_read(const char *filename, struct capture *cap)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap = pcap_open_offline(filename, errbuf);
+    if (!pcap)
+    {
+        fprintf(stderr, "ERR: open pcap(%s) failed: %s\n", filename, errbuf);
+        return -EINVAL;
+    }
+    if (pcap_datalink(pcap) != DLT_EN10MB)
+    {
+        fprintf(stderr, "ERR: pcap(%s) link type %d is not Ethernet\n", filename, pcap_datalink(pcap));
+        pcap_close(pcap);
+        return -EINVAL;
+    }
+
+    __u64 cap_frames = 1024, cap_bytes = 1 << 20, off = 0;
+    memset(cap, 0, sizeof(*cap));
+    cap->frames = malloc(cap_frames * sizeof(*cap->frames));
+    cap->buf = malloc(cap_bytes);
+
+    struct pcap_pkthdr *hdr;
+    const __u8 *data;
+    int ret = 0, err = 0;
+    while (cap->frames && cap->buf && (ret = pcap_next_ex(pcap, &hdr, &data)) == 1)
+    {
+        /* test_run rejects frames shorter than an Ethernet header */
+        if (hdr->caplen < ETH_HLEN)
+        {
+            cap->skipped++;
+            continue;
+        }
+
+        if (cap->nr == cap_frames)
+        {
+            cap_frames *= 2;
+            struct frame *frames = realloc(cap->frames, cap_frames * sizeof(*frames));
+            if (!frames)
+            {
+                break;
+            }
+            cap->frames = frames;
+        }
+        while (off + hdr->caplen > cap_bytes)
+        {
+            cap_bytes *= 2;
+            __u8 *buf = realloc(cap->buf, cap_bytes);
+            if (!buf)
+            {
+                err = -ENOMEM;
+                goto out;
+            }
+            cap->buf = buf;
+        }
+
+        memcpy(cap->buf + off, data, hdr->caplen);
+        /* Offsets for now, buf may still move */
+        cap->frames[cap->nr].data = (const __u8 *)(uintptr_t)off;
+        cap->frames[cap->nr].len = hdr->caplen;
+        cap->nr++;
+        cap->bytes += hdr->caplen;
+        off += hdr->caplen;
+    }
+    if (!cap->frames || !cap->buf || ret == 1)
+    {
+        err = -ENOMEM;
+    }
+    else if (ret == -1)
+    {
+        fprintf(stderr, "ERR: read pcap(%s) failed: %s\n", filename, pcap_geterr(pcap));
+        err = -EIO;
+    }
+
+out:
+    pcap_close(pcap);
+    if (err)
+    {
+        free(cap->frames);
+        free(cap->buf);
+        return err;
+    }
+
+    for (__u64 i = 0; i < cap->nr; i++)
+    {
+        cap->frames[i].data = cap->buf + (uintptr_t)cap->frames[i].data;
+    }
+    return 0;
+}
+
+static void *replay_worker_run(void *arg)
+{
+    struct replay_worker *w = arg;
+    const struct capture *cap = w->cap;
+
+    while (1)
+    {
+        __u64 start = __atomic_fetch_add(w->next, w->batch, __ATOMIC_RELAXED);
+        if (start >= cap->nr)
+        {
+            break;
+        }
+        __u64 end = start + w->batch < cap->nr ? start + w->batch : cap->nr;
+
+        for (__u64 i = start; i < end; i++)
+        {
+            /* No data_out, copying the frame back is not what we measure */
+            struct bpf_prog_test_run_attr attr = {
+                .prog_fd = w->prog_fd,
+                .repeat = w->repeat,
+                .data_in = cap->frames[i].data,
+                .data_size_in = cap->frames[i].len,
+            };
+            if (bpf_prog_test_run_xattr(&attr))
+            {
+                w->res.errors++;
+                continue;
+            }
+
+            w->res.run_ns += attr.duration;
+            if (attr.retval < XDP_ACTION_MAX)
+            {
+                w->res.verdict[attr.retval]++;
+                w->res.verdict_bytes[attr.retval] += cap->frames[i].len;
+            }
+            else
+            {
+                w->res.unknown++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void replay_print(const struct capture *cap, const struct replay_result *res,
+                         __u64 wall_ns, __u32 threads, __u32 repeat)
+{
+    __u64 runs = cap->nr - res->errors;
+
+    printf("\nframes %'llu (%'llu bytes), skipped %'llu short, %'llu test_run errors\n",
+           cap->nr, cap->bytes, cap->skipped, res->errors);
+    printf("%-12s %14s %8s %16s\n", "verdict", "pkts", "share", "bytes");
+    for (__u32 act = 0; act < XDP_ACTION_MAX; act++)
+    {
+        double share = runs ? (double)res->verdict[act] * 100 / runs : 0;
+        printf("%-12s %'14llu %7.2f%% %'16llu\n", action2str(act), res->verdict[act], share, res->verdict_bytes[act]);
+    }
+    if (res->unknown)
+    {
+        printf("%-12s %'14llu\n", "UNKNOWN", res->unknown);
+    }
+
+    if (!runs || !wall_ns)
+    {
+        return;
+    }
+    printf("\nprog   %'10.1f ns/pkt (kernel test_run mean)\n", (double)res->run_ns / runs);
+    runs *= repeat;
+    printf("wall   %'10.1f ns/pkt over %u threads, %'.3f Mpps\n",
+           (double)wall_ns * threads / runs, threads, (double)runs * 1000 / wall_ns);
+}
+
+/* The prog's own accounting, counts every --repeat run and scales with --sample */
+static void stat_map_print(struct bpf_object *obj)
+{
+    int fd = bpf_object__find_map_fd_by_name(obj, "xdp_stat_map");
+    if (fd < 0)
+    {
+        return;
+    }
+
+    printf("\nxdp_stat_map\n");
+    for (__u32 key = 0; key < XDP_ACTION_MAX; key++)
+    {
+        struct datarec rec = {0};
+        if (!bpf_map_lookup_elem(fd, &key, &rec))
+        {
+            printf("%-12s %'14llu pkts %'16llu bytes\n", action2str(key), rec.rx_pkts, rec.rx_bytes);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct config cfg = {
+        .replay_threads = default_replay_threads,
+        .replay_batch = default_replay_batch,
+        .replay_repeat = default_replay_repeat,
+    };
+    strncpy(cfg.obj_filename, default_bpf_obj_filename, sizeof(cfg.obj_filename));
+
+    parse_cmd_args(
+        argc,
+        argv,
+        wrappers,
+        &cfg);
+
+    if (!cfg.pcap_file[0])
+    {
+        fprintf(stderr, "ERR: required option --pcap missing\n\n");
+        return EXIT_ACQUIRE_OPT_FAIL;
+    }
+
+    struct capture cap;
+    if (capture_read(cfg.pcap_file, &cap))
+    {
+        return EXIT_FAIL;
+    }
+
+    /* Same switches main would load with */
+    struct xdp_features features;
+    const char *stub_maps[XDP_FEATURES_STUB_MAX + 1];
+    xdp_features_from_cfg(&cfg, &features);
+    xdp_features_stub_maps(&features, stub_maps);
+    struct bpf_object *obj = load_bpf_obj_file_rodata(cfg.obj_filename, 0, NULL, &features, sizeof(features), stub_maps);
+    if (!obj)
+    {
+        return EXIT_FAIL_BPF;
+    }
+
+    struct bpf_program *prog = cfg.progsec[0] ? bpf_object__find_program_by_title(obj, cfg.progsec) : bpf_program__next(NULL, obj);
+    int prog_fd = prog ? bpf_program__fd(prog) : -1;
+    if (prog_fd < 0)
+    {
+        fprintf(stderr, "ERR: no program in file(%s)\n", cfg.obj_filename);
+        return EXIT_FAIL_BPF;
+    }
+
+    if (features.filter)
+    {
+        int err = filter_load(cfg.filter_file,
+                              bpf_object__find_map_fd_by_name(obj, "xdp_filter_map"),
+                              features.filter_bloom ? bpf_object__find_map_fd_by_name(obj, "xdp_filter_bloom") : -1,
+                              cfg.bloom_fp);
+        if (err)
+        {
+            return err;
+        }
+    }
+    if (features.classifier)
+    {
+        int err = classifier_load_obj(obj, cfg.rules_file);
+        if (err)
+        {
+            return err;
+        }
+    }
+
+    setlocale(LC_NUMERIC, "en_US");
+    printf("replaying %'llu frames from %s through %s(%s), %u threads\n",
+           cap.nr, cfg.pcap_file, cfg.obj_filename, bpf_program__title(prog, false), cfg.replay_threads);
+
+    struct replay_worker *workers = calloc(cfg.replay_threads, sizeof(*workers));
+    if (!workers)
+    {
+        return EXIT_FAIL;
+    }
+
+    __u64 next = 0;
+    __u64 start = gettime();
+    __u32 started = 0;
+    for (; started < cfg.replay_threads; started++)
+    {
+        struct replay_worker *w = &workers[started];
+        w->prog_fd = prog_fd;
+        w->repeat = cfg.replay_repeat;
+        w->batch = cfg.replay_batch;
+        w->cap = &cap;
+        w->next = &next;
+        if (pthread_create(&w->tid, NULL, replay_worker_run, w))
+        {
+            fprintf(stderr, "ERR: start worker %u failed\n", started);
+            break;
+        }
+    }
+
+    struct replay_result total = {0};
+    for (__u32 i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].tid, NULL);
+        for (__u32 act = 0; act < XDP_ACTION_MAX; act++)
+        {
+            total.verdict[act] += workers[i].res.verdict[act];
+            total.verdict_bytes[act] += workers[i].res.verdict_bytes[act];
+        }
+        total.unknown += workers[i].res.unknown;
+        total.errors += workers[i].res.errors;
+        total.run_ns += workers[i].res.run_ns;
+    }
+    __u64 wall_ns = gettime() - start;
+
+    replay_print(&cap, &total, wall_ns, started, cfg.replay_repeat);
+    stat_map_print(obj);
+    if (features.filter)
+    {
+        filter_stat_totals_print(bpf_object__find_map_fd_by_name(obj, "xdp_filter_stat_map"));
+    }
+
+    free(workers);
+    free(cap.frames);
+    free(cap.buf);
+    return started ? EXIT_OK : EXIT_FAIL;
+}
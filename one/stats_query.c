@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <locale.h>
+#include <time.h>
+
+#include "../global/common_define.h"
+#include "../global/cmd_args.h"
+#include "../global/xdp_helper.h"
+#include "../global/ts_ring.h"
+
+static const __u32 default_query_window = 60;
+
+struct option_wrapper wrappers[] = {
+    {{"ts-file", required_argument, NULL, 6}, "ring file written by main --ts-file", "<file>", .required = true},
+    {{"window", required_argument, NULL, 8}, "window length in seconds", "<sec>"},
+    {{"end", required_argument, NULL, 9}, "window ends this many seconds before the newest record", "<sec>"},
+
+    {{0, 0, NULL, 0}},
+};
+
+/* Counters restart from zero when the XDP prog is reloaded */
+static __u64 counter_delta(__u64 curr, __u64 prev)
+{
+    return curr >= prev ? curr - prev : curr;
+}
+
+int query_window(struct ts_ring *ring, __u64 from_ts, __u64 to_ts)
+{
+    struct ts_ring_counter sum[XDP_ACTION_MAX] = {0};
+    struct ts_ring_entry prev, curr;
+    __u64 first_ts = 0, last_ts = 0, nr_rec = 0;
+    bool have_prev = false;
+
+    __u64 head = ts_ring_head(ring);
+    for (__u64 seq = ts_ring_tail(ring); seq < head; seq++)
+    {
+        /* Counters are cumulative, a torn slot just widens one interval */
+        if (ts_ring_read(ring, seq, &curr) || curr.ts < from_ts)
+        {
+            continue;
+        }
+        if (curr.ts > to_ts)
+        {
+            break;
+        }
+
+        if (!have_prev)
+        {
+            first_ts = curr.ts;
+        }
+        else
+        {
+            for (__u32 key = 0; key < XDP_ACTION_MAX; key++)
+            {
+                sum[key].pkts += counter_delta(curr.act[key].pkts, prev.act[key].pkts);
+                sum[key].bytes += counter_delta(curr.act[key].bytes, prev.act[key].bytes);
+            }
+        }
+        last_ts = curr.ts;
+        prev = curr;
+        have_prev = true;
+        nr_rec++;
+    }
+
+    if (nr_rec < 2 || last_ts <= first_ts)
+    {
+        fprintf(stderr, "ERR: need at least 2 records in window, found %llu\n", nr_rec);
+        return EXIT_FAIL;
+    }
+
+    double period = (double)(last_ts - first_ts) / NANOSEC_PER_SEC;
+    printf("window %.0f sec over %llu records\n", period, nr_rec);
+    for (__u32 key = 0; key < XDP_ACTION_MAX; key++)
+    {
+        double pps = (double)sum[key].pkts / period;
+        double mbps = (double)sum[key].bytes * 8 / period / 1000000;
+        printf("%-12s %'14llu pkts (%'10.0f pps) %'11.2f Mbit/s\n", action2str(key), sum[key].pkts, pps, mbps);
+    }
+    return EXIT_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    struct config cfg = {
+        .query_window = default_query_window,
+    };
+
+    parse_cmd_args(
+        argc,
+        argv,
+        wrappers,
+        &cfg);
+
+    if (!cfg.ts_filename[0])
+    {
+        fprintf(stderr, "ERR: required option --ts-file missing\n\n");
+        return EXIT_ACQUIRE_OPT_FAIL;
+    }
+
+    struct ts_ring ring = {.fd = -1};
+    int err = ts_ring_open_ro(&ring, cfg.ts_filename);
+    if (err)
+    {
+        return EXIT_FAIL;
+    }
+
+    setlocale(LC_NUMERIC, "en_US");
+
+    __u64 head = ts_ring_head(&ring);
+    struct ts_ring_entry newest;
+    if (!head || ts_ring_read(&ring, head - 1, &newest))
+    {
+        fprintf(stderr, "ERR: ts file(%s) has no records\n", cfg.ts_filename);
+        ts_ring_close(&ring);
+        return EXIT_FAIL;
+    }
+
+    __u64 end_off = (__u64)cfg.query_end * NANOSEC_PER_SEC;
+    __u64 to_ts = newest.ts > end_off ? newest.ts - end_off : 0;
+    __u64 win = (__u64)cfg.query_window * NANOSEC_PER_SEC;
+    __u64 from_ts = to_ts > win ? to_ts - win : 0;
+
+    time_t to_sec = to_ts / NANOSEC_PER_SEC;
+    printf("dev %s ifidx(%u) records(%llu/%llu) window ends %s",
+           ring.hdr->netif_name, ring.hdr->netif_idx, head - ts_ring_tail(&ring),
+           ring.hdr->capacity, ctime(&to_sec));
+
+    err = query_window(&ring, from_ts, to_ts);
+    ts_ring_close(&ring);
+    return err;
+}
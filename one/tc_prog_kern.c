@@ -0,0 +1,59 @@
+#include <linux/bpf.h>
+#include <linux/pkt_cls.h>
+#include <bpf/bpf_helpers.h>
+#include "common_user_kern.h"
+#include "parsing_helpers.h"
+#include "../global/common_define.h"
+
+struct bpf_map_def SEC("maps") tc_stat_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct datarec),
+	.max_entries = TC_STAT_MAX,
+};
+
+/* Companion of xdp_stat_prog on ingress, marks skbs with the XDP class id */
+SEC("tc_classify")
+int tc_classify_prog(struct __sk_buff *skb)
+{
+	void *data_end = (void *)(long)skb->data_end;
+	void *data = (void *)(long)skb->data;
+	struct xdp_meta *meta = (void *)(long)skb->data_meta;
+	__u32 flow_hash = 0, class_id = 0, key;
+
+	if ((void *)(meta + 1) <= data && meta->magic == XDP_META_MAGIC)
+	{
+		flow_hash = meta->flow_hash;
+		class_id = meta->class_id;
+		key = TC_STAT_META;
+	}
+	else
+	{
+		/* No XDP in front, or its driver lacks metadata support */
+		struct flow_v4 flow;
+		int proto = parse_flow_v4(data, data_end, &flow);
+		if (proto >= 0)
+		{
+			flow_hash = flow_v4_hash(&flow);
+			class_id = FLOW_CLASS_ID(proto, bpf_ntohs(flow.dport));
+		}
+		key = TC_STAT_REPARSE;
+	}
+
+	skb->mark = class_id;
+	if (flow_hash)
+	{
+		bpf_set_hash(skb, flow_hash);
+	}
+
+	struct datarec *rec = bpf_map_lookup_elem(&tc_stat_map, &key);
+	if (rec)
+	{
+		__sync_fetch_and_add(&rec->rx_pkts, 1);
+		__sync_fetch_and_add(&rec->rx_bytes, skb->len);
+	}
+
+	return TC_ACT_OK;
+}
+
+char _license[] SEC("license") = "GPL";
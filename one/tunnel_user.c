@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <bpf/bpf.h>
+
+#include "../global/common_define.h"
+#include "../global/xdp_helper.h"
+#include "tunnel_user.h"
+
+static const char *tun_type2str(__u32 type)
+{
+    switch (type)
+    {
+    case TUN_VXLAN:
+        return "vxlan";
+    case TUN_GRE:
+        return "gre";
+    default:
+        return "unknown";
+    }
+}
+
+static bool tun_conf_has(const struct tun_key *keys, __u32 nr, const struct tun_key *key)
+{
+    for (__u32 i = 0; i < nr; i++)
+    {
+        if (!memcmp(&keys[i], key, sizeof(*key)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int tunnel_load_file(const struct config *cfg)
+{
+    FILE *fp = fopen(cfg->tun_file, "r");
+    if (!fp)
+    {
+        int err = errno;
+        fprintf(stderr, "ERR: open tunnel file(%s) failed(%d): %s\n", cfg->tun_file, err, strerror(err));
+        return EXIT_FAIL;
+    }
+
+    struct tun_key keys[TUN_MAX];
+    struct tun_info infos[TUN_MAX];
+    __u32 nr = 0;
+    int lineno = 0, err = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char type[16], addr[INET_ADDRSTRLEN], arg[16] = "", ifname[IF_NAMESIZE] = "";
+        int n = sscanf(line, "%15s %15s %15s %15s", type, addr, arg, ifname);
+        if (n <= 0)
+        {
+            continue;
+        }
+        if (n < 2 || nr >= TUN_MAX)
+        {
+            err = -EINVAL;
+            break;
+        }
+
+        struct tun_key *key = &keys[nr];
+        struct tun_info *info = &infos[nr];
+        memset(key, 0, sizeof(*key));
+        memset(info, 0, sizeof(*info));
+        if (!strcmp(type, "vxlan"))
+        {
+            char *end;
+            unsigned long vni = strtoul(arg, &end, 10);
+            if (!arg[0] || *end || vni >= 1 << 24)
+            {
+                err = -EINVAL;
+                break;
+            }
+            key->type = TUN_VXLAN;
+            key->vni = htonl(vni << 8);
+        }
+        else if (!strcmp(type, "gre") && n < 4)
+        {
+            key->type = TUN_GRE;
+            strcpy(ifname, arg);
+        }
+        else
+        {
+            err = -EINVAL;
+            break;
+        }
+        if (inet_pton(AF_INET, addr, &key->addr) != 1)
+        {
+            err = -EINVAL;
+            break;
+        }
+        if (ifname[0] && !(info->ifindex = if_nametoindex(ifname)))
+        {
+            err = -ENODEV;
+            break;
+        }
+        /* A second line would silently overwrite the first in the map */
+        if (tun_conf_has(keys, nr, key))
+        {
+            err = -EEXIST;
+            break;
+        }
+        info->tun_idx = nr++;
+    }
+    fclose(fp);
+
+    if (err)
+    {
+        fprintf(stderr, "ERR: tunnel file(%s) line %d invalid(%d): %s\n", cfg->tun_file, lineno, -err, strerror(-err));
+        return EXIT_FAIL;
+    }
+
+    int map_fd = open_bpf_map_file_by_name(cfg, "tun_endpoint_map", NULL);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_BPF;
+    }
+
+    /* Drop endpoints no longer listed first, the map only holds TUN_MAX */
+    struct tun_key key, next;
+    void *prev_key = NULL;
+    while (!bpf_map_get_next_key(map_fd, prev_key, &next))
+    {
+        if (!tun_conf_has(keys, nr, &next))
+        {
+            bpf_map_delete_elem(map_fd, &next);
+            continue;
+        }
+        key = next;
+        prev_key = &key;
+    }
+
+    for (__u32 i = 0; i < nr; i++)
+    {
+        if (bpf_map_update_elem(map_fd, &keys[i], &infos[i], BPF_ANY))
+        {
+            fprintf(stderr, "ERR: update tunnel endpoint(%u) failed\n", i);
+            return EXIT_FAIL_BPF;
+        }
+    }
+
+    printf("INFO: tunnel file(%s) loaded %u endpoints\n", cfg->tun_file, nr);
+    return EXIT_OK;
+}
+
+int tunnel_stats_open(const struct config *cfg, struct tunnel_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->endpoint_fd = open_bpf_map_file_by_name(cfg, "tun_endpoint_map", NULL);
+    stats->stat_fd = open_bpf_map_file_by_name(cfg, "tun_stat_map", NULL);
+    if (stats->endpoint_fd < 0 || stats->stat_fd < 0)
+    {
+        return EXIT_FAIL_BPF;
+    }
+    return EXIT_OK;
+}
+
+void tunnel_stats_collect(struct tunnel_stats *stats)
+{
+    stats->ts = gettime();
+    for (__u32 key = 0; key < TUN_MAX; key++)
+    {
+        bpf_map_lookup_elem(stats->stat_fd, &key, &stats->tun[key]);
+    }
+}
+
+void tunnel_stats_print(struct tunnel_stats *stats, struct tunnel_stats *prev)
+{
+    double period = (double)(stats->ts - prev->ts) / NANOSEC_PER_SEC;
+    if (period <= 0)
+    {
+        return;
+    }
+
+    char addr[INET_ADDRSTRLEN], label[64];
+    struct tun_key key, next;
+    struct tun_info info;
+    void *prev_key = NULL;
+    while (!bpf_map_get_next_key(stats->endpoint_fd, prev_key, &next))
+    {
+        if (!bpf_map_lookup_elem(stats->endpoint_fd, &next, &info) && info.tun_idx < TUN_MAX)
+        {
+            struct datarec *rec = &stats->tun[info.tun_idx], *old = &prev->tun[info.tun_idx];
+            __u64 pkts = rec->rx_pkts - old->rx_pkts;
+            __u64 bytes = rec->rx_bytes - old->rx_bytes;
+
+            inet_ntop(AF_INET, &next.addr, addr, sizeof(addr));
+            if (next.type == TUN_VXLAN)
+            {
+                snprintf(label, sizeof(label), "tun %s %s vni %u", tun_type2str(next.type), addr, ntohl(next.vni) >> 8);
+            }
+            else
+            {
+                snprintf(label, sizeof(label), "tun %s %s", tun_type2str(next.type), addr);
+            }
+            printf("%-28s %lld pkts (%'10.0f pps) %'11.2f Mbit/s decap\n",
+                   label, pkts, pkts / period, (double)bytes * 8 / period / 1000000);
+        }
+        key = next;
+        prev_key = &key;
+    }
+}
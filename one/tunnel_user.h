@@ -0,0 +1,36 @@
+#ifndef __ONE_TUNNEL_USER_H
+#define __ONE_TUNNEL_USER_H
+
+#include <linux/types.h>
+
+#include "../global/common_define.h"
+#include "common_user_kern.h"
+
+/*
+ * --tunnels file format, one endpoint per line, '#' starts a comment:
+ *
+ *   vxlan <local ipv4> <vni> [<ifname>]
+ *   gre <local ipv4> [<ifname>]
+ *
+ * An outer address takes one gre line and any number of vxlan lines
+ * with distinct VNIs. Frames to that outer address (and VNI) are
+ * decapsulated in XDP and the inner frame is redirected to ifname, or
+ * passed up the stack without one. Passed up, it enters the stack on the
+ * receiving device with that device's MAC as destination, so rp_filter
+ * there must accept the inner source.
+ */
+int tunnel_load_file(const struct config *cfg);
+
+struct tunnel_stats
+{
+    int endpoint_fd;
+    int stat_fd;
+    __u64 ts;
+    struct datarec tun[TUN_MAX];
+};
+
+int tunnel_stats_open(const struct config *cfg, struct tunnel_stats *stats);
+void tunnel_stats_collect(struct tunnel_stats *stats);
+void tunnel_stats_print(struct tunnel_stats *stats, struct tunnel_stats *prev);
+
+#endif
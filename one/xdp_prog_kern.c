@@ -1,6 +1,7 @@
 #include <linux/bpf.h>
 #include <bpf/bpf_helpers.h>
 #include "common_user_kern.h"
+#include "parsing_helpers.h"
 #include "../global/common_define.h"
 
 struct bpf_map_def SEC("maps") xdp_stat_map = {
@@ -10,19 +11,637 @@ struct bpf_map_def SEC("maps") xdp_stat_map = {
 	.max_entries = XDP_ACTION_MAX,
 };
 
-SEC("xdp_stat")
-int xdp_stat_prog(struct xdp_md *ctx)
+struct bpf_map_def SEC("maps") xdp_size_hist_map = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u64),
+	.max_entries = SIZE_HIST_BUCKETS,
+};
+
+/* Keyed by rx_queue_index, per-CPU values give the queue x CPU matrix */
+struct bpf_map_def SEC("maps") xdp_rxq_stat_map = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct datarec),
+	.max_entries = RXQ_MAX,
+};
+
+struct bpf_map_def SEC("maps") tun_endpoint_map = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(struct tun_key),
+	.value_size = sizeof(struct tun_info),
+	.max_entries = TUN_MAX,
+};
+
+struct bpf_map_def SEC("maps") tun_stat_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct datarec),
+	.max_entries = TUN_MAX,
+};
+
+struct bpf_map_def SEC("maps") cls_ctl_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct cls_ctl),
+	.max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") cls_src_map = {
+	.type = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size = sizeof(struct cls_addr_key),
+	.value_size = sizeof(struct cls_bitmap),
+	.max_entries = CLS_ADDR_PREFIXES,
+	.map_flags = BPF_F_NO_PREALLOC,
+};
+
+struct bpf_map_def SEC("maps") cls_dst_map = {
+	.type = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size = sizeof(struct cls_addr_key),
+	.value_size = sizeof(struct cls_bitmap),
+	.max_entries = CLS_ADDR_PREFIXES,
+	.map_flags = BPF_F_NO_PREALLOC,
+};
+
+struct bpf_map_def SEC("maps") cls_sport_map = {
+	.type = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size = sizeof(struct cls_port_key),
+	.value_size = sizeof(struct cls_bitmap),
+	.max_entries = CLS_PORT_PREFIXES,
+	.map_flags = BPF_F_NO_PREALLOC,
+};
+
+struct bpf_map_def SEC("maps") cls_dport_map = {
+	.type = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size = sizeof(struct cls_port_key),
+	.value_size = sizeof(struct cls_bitmap),
+	.max_entries = CLS_PORT_PREFIXES,
+	.map_flags = BPF_F_NO_PREALLOC,
+};
+
+struct bpf_map_def SEC("maps") cls_proto_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct cls_bitmap),
+	.max_entries = 2 * 256,
+};
+
+struct bpf_map_def SEC("maps") cls_flags_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct cls_bitmap),
+	.max_entries = 2 * 256,
+};
+
+/* XDP action per rule, indexed by set * CLS_MAX_RULES + rule */
+struct bpf_map_def SEC("maps") cls_action_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u32),
+	.max_entries = 2 * CLS_MAX_RULES,
+};
+
+struct bpf_map_def SEC("maps") cls_rule_stat_map = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct datarec),
+	.max_entries = 2 * CLS_MAX_RULES,
+};
+
+/*
+ * IPv4 source denylist, only consulted with features.filter. The table
+ * sits behind a one slot outer map so userspace can swap in a larger
+ * copy, xdp_filter_map_inner is the template and first table.
+ */
+struct bpf_map_def SEC("maps") xdp_filter_map_inner = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(__be32),
+	.value_size = sizeof(__u32),
+	.max_entries = FILTER_INIT_ENTRIES,
+};
+
+struct bpf_map_def SEC("maps") xdp_filter_map = {
+	.type = BPF_MAP_TYPE_ARRAY_OF_MAPS,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u32),
+	.max_entries = 1,
+};
+
+/* Prefilter over the same addresses, rebuilt and swapped on every load */
+struct bpf_map_def SEC("maps") xdp_filter_bloom_inner = {
+	.type = BPF_MAP_TYPE_BLOOM_FILTER,
+	.key_size = 0,
+	.value_size = sizeof(__be32),
+	.max_entries = FILTER_INIT_ENTRIES,
+};
+
+struct bpf_map_def SEC("maps") xdp_filter_bloom = {
+	.type = BPF_MAP_TYPE_ARRAY_OF_MAPS,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u32),
+	.max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") xdp_filter_stat_map = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct datarec),
+	.max_entries = FILTER_STAT_MAX,
+};
+
+struct bpf_map_def SEC("maps") lb_vip_map = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(struct lb_vip_key),
+	.value_size = sizeof(struct lb_vip_meta),
+	.max_entries = LB_MAX_VIPS,
+};
+
+struct bpf_map_def SEC("maps") lb_maglev_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u32),
+	.max_entries = LB_MAGLEV_ENTRIES,
+};
+
+struct bpf_map_def SEC("maps") lb_backend_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct lb_backend),
+	.max_entries = LB_MAX_BACKENDS,
+};
+
+struct bpf_map_def SEC("maps") lb_vip_stat_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct datarec),
+	.max_entries = LB_MAX_VIPS,
+};
+
+struct bpf_map_def SEC("maps") lb_backend_stat_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct datarec),
+	.max_entries = LB_MAX_BACKENDS,
+};
+
+const volatile struct xdp_features features = {
+	.count_bytes = 1,
+};
+
+static __always_inline void datarec_add(struct bpf_map_def *map, __u32 key, __u64 bytes)
+{
+	struct datarec *rec = bpf_map_lookup_elem(map, &key);
+	if (rec)
+	{
+		__sync_fetch_and_add(&rec->rx_pkts, 1);
+		if (features.count_bytes)
+		{
+			__sync_fetch_and_add(&rec->rx_bytes, bytes);
+		}
+	}
+}
+
+static __always_inline void size_hist_add(__u64 bytes, __u32 weight)
+{
+	__u32 key = 0;
+
+#pragma unroll
+	for (__u32 i = 0; i < SIZE_HIST_BUCKETS - 1; i++)
+	{
+		if (bytes >= SIZE_HIST_BOUND(i))
+		{
+			key = i + 1;
+		}
+	}
+
+	__u64 *cnt = bpf_map_lookup_elem(&xdp_size_hist_map, &key);
+	if (cnt)
+	{
+		*cnt += weight;
+	}
+}
+
+static __always_inline void rxq_stats_record(struct xdp_md *ctx)
 {
-	__u32 key = XDP_PASS;
-	struct datarec *rec = bpf_map_lookup_elem(&xdp_stat_map, &key);
+	__u32 key = ctx->rx_queue_index;
+	if (key >= RXQ_MAX)
+	{
+		key = RXQ_MAX - 1;
+	}
+
+	struct datarec *rec = bpf_map_lookup_elem(&xdp_rxq_stat_map, &key);
+	if (rec)
+	{
+		rec->rx_pkts++;
+		if (features.count_bytes)
+		{
+			rec->rx_bytes += ctx->data_end - ctx->data;
+		}
+	}
+}
+
+static __always_inline __u32 xdp_stats_record_action(struct xdp_md *ctx, __u32 action)
+{
+	if (action >= XDP_ACTION_MAX)
+	{
+		return XDP_ABORTED;
+	}
+
+	__u32 weight = 1;
+	if (features.sample_rate > 1)
+	{
+		if (bpf_get_prandom_u32() % features.sample_rate)
+		{
+			return action;
+		}
+		weight = features.sample_rate;
+	}
+
+	struct datarec *rec = bpf_map_lookup_elem(&xdp_stat_map, &action);
 	if (!rec)
 	{
 		return XDP_ABORTED;
 	}
 
-	__sync_fetch_and_add(&rec->rx_pkts, 1);
+	__u64 bytes = ctx->data_end - ctx->data;
+	__sync_fetch_and_add(&rec->rx_pkts, weight);
+	if (features.count_bytes)
+	{
+		__sync_fetch_and_add(&rec->rx_bytes, bytes * weight);
+	}
+	if (features.size_histogram)
+	{
+		size_hist_add(bytes, weight);
+	}
+
+	return action;
+}
+
+/*
+ * Strip VXLAN or GRE outer headers of frames sent to a configured
+ * endpoint. Returns false for anything else, leaving the frame intact.
+ * Inner Ethernet frames passed to the stack take the outer dst MAC, the
+ * inner one belongs to the overlay and would make them PACKET_OTHERHOST.
+ */
+static __always_inline bool tunnel_decap(struct xdp_md *ctx, struct flow_v4 *flow, int proto, __u32 *action)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct tun_key key = {.addr = flow->iph->daddr};
+	bool inner_ip = false;
+	int hdr_len;
+
+	if (flow->frag)
+	{
+		return false;
+	}
+
+	if (proto == IPPROTO_UDP && flow->dport == bpf_htons(VXLAN_PORT))
+	{
+		struct vxlanhdr *vxh = data + flow->l4_off + sizeof(struct udphdr);
+		if ((void *)(vxh + 1) > data_end || !(vxh->vx_flags & bpf_htonl(VXLAN_F_VNI)))
+		{
+			return false;
+		}
+
+		/* The low byte is reserved */
+		key.vni = vxh->vx_vni & bpf_htonl(0xffffff00);
+		key.type = TUN_VXLAN;
+		hdr_len = flow->l4_off + sizeof(struct udphdr) + sizeof(struct vxlanhdr);
+	}
+	else if (proto == IPPROTO_GRE)
+	{
+		struct grehdr *gre = data + flow->l4_off;
+		if ((void *)(gre + 1) > data_end || gre->flags & bpf_htons(GRE_ROUTING | GRE_VERSION))
+		{
+			return false;
+		}
+
+		key.type = TUN_GRE;
+		hdr_len = flow->l4_off + sizeof(*gre);
+		hdr_len += gre->flags & bpf_htons(GRE_CSUM) ? 4 : 0;
+		hdr_len += gre->flags & bpf_htons(GRE_KEY) ? 4 : 0;
+		hdr_len += gre->flags & bpf_htons(GRE_SEQ) ? 4 : 0;
+
+		if (gre->proto == bpf_htons(ETH_P_IP))
+		{
+			/* L3 payload, keep room to rebuild an Ethernet header */
+			inner_ip = true;
+			hdr_len -= sizeof(struct ethhdr);
+		}
+		else if (gre->proto != bpf_htons(ETH_P_TEB))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+	struct tun_info *tun = bpf_map_lookup_elem(&tun_endpoint_map, &key);
+	if (!tun)
+	{
+		return false;
+	}
+
+	__u32 tun_idx = tun->tun_idx, ifindex = tun->ifindex;
+	struct ethhdr outer_eth = *flow->eth;
+
+	if (bpf_xdp_adjust_head(ctx, hdr_len))
+	{
+		*action = XDP_ABORTED;
+		return true;
+	}
+
+	data_end = (void *)(long)ctx->data_end;
+	data = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	if ((void *)(eth + 1) > data_end)
+	{
+		*action = XDP_ABORTED;
+		return true;
+	}
+
+	if (inner_ip)
+	{
+		__builtin_memcpy(eth, &outer_eth, sizeof(*eth));
+		eth->h_proto = bpf_htons(ETH_P_IP);
+	}
+	else if (!ifindex)
+	{
+		__builtin_memcpy(eth->h_dest, outer_eth.h_dest, ETH_ALEN);
+	}
+
+	datarec_add(&tun_stat_map, tun_idx, data_end - data);
+	*action = ifindex ? bpf_redirect(ifindex, 0) : XDP_PASS;
+	return true;
+}
+
+/* No ctz instruction in BPF, and a lookup table would land in .rodata */
+static __always_inline __u32 ctz64(__u64 w)
+{
+	__u32 n = 0;
+
+	if (!(w & 0xffffffffULL))
+	{
+		n += 32;
+		w >>= 32;
+	}
+	if (!(w & 0xffff))
+	{
+		n += 16;
+		w >>= 16;
+	}
+	if (!(w & 0xff))
+	{
+		n += 8;
+		w >>= 8;
+	}
+	if (!(w & 0xf))
+	{
+		n += 4;
+		w >>= 4;
+	}
+	if (!(w & 0x3))
+	{
+		n += 2;
+		w >>= 2;
+	}
+	if (!(w & 0x1))
+	{
+		n += 1;
+	}
+	return n;
+}
+
+/* First rule matching all fields, cost depends on CLS_MAX_RULES only */
+static __always_inline __u32 cls_match(struct flow_v4 *flow, int proto, __u8 *set)
+{
+	__u32 zero = 0;
+	struct cls_ctl *ctl = bpf_map_lookup_elem(&cls_ctl_map, &zero);
+	if (!ctl)
+	{
+		return CLS_NO_MATCH;
+	}
+	*set = ctl->active & 1;
+
+	struct cls_addr_key saddr = {.prefixlen = 8 + 32, .set = *set, .addr = flow->iph->saddr};
+	struct cls_addr_key daddr = {.prefixlen = 8 + 32, .set = *set, .addr = flow->iph->daddr};
+	struct cls_port_key sport = {.prefixlen = 8 + 16, .set = *set, .port = flow->sport};
+	struct cls_port_key dport = {.prefixlen = 8 + 16, .set = *set, .port = flow->dport};
+	__u32 proto_key = CLS_ARRAY_KEY(*set, proto & 0xff);
+	__u32 flags_key = CLS_ARRAY_KEY(*set, flow->tcp_flags);
+
+	struct cls_bitmap *src = bpf_map_lookup_elem(&cls_src_map, &saddr);
+	struct cls_bitmap *dst = bpf_map_lookup_elem(&cls_dst_map, &daddr);
+	struct cls_bitmap *sp = bpf_map_lookup_elem(&cls_sport_map, &sport);
+	struct cls_bitmap *dp = bpf_map_lookup_elem(&cls_dport_map, &dport);
+	struct cls_bitmap *pr = bpf_map_lookup_elem(&cls_proto_map, &proto_key);
+	struct cls_bitmap *fl = bpf_map_lookup_elem(&cls_flags_map, &flags_key);
+	if (!src || !dst || !sp || !dp || !pr || !fl)
+	{
+		return CLS_NO_MATCH;
+	}
+
+	for (__u32 i = 0; i < CLS_BITMAP_WORDS; i++)
+	{
+		__u64 w = src->w[i] & dst->w[i] & sp->w[i] & dp->w[i] & pr->w[i] & fl->w[i];
+		if (w)
+		{
+			return i * 64 + ctz64(w);
+		}
+	}
+	return CLS_NO_MATCH;
+}
+
+static __always_inline __u32 cls_apply(struct xdp_md *ctx, struct flow_v4 *flow, int proto)
+{
+	__u8 set;
+	__u32 rule = cls_match(flow, proto, &set);
+	if (rule >= CLS_MAX_RULES)
+	{
+		return XDP_PASS;
+	}
+
+	/* Counters are per set too, a swap must not mix two rule lists */
+	__u32 key = set * CLS_MAX_RULES + rule;
+	struct datarec *rec = bpf_map_lookup_elem(&cls_rule_stat_map, &key);
+	if (rec)
+	{
+		rec->rx_pkts++;
+		rec->rx_bytes += ctx->data_end - ctx->data;
+	}
+
+	__u32 *action = bpf_map_lookup_elem(&cls_action_map, &key);
+	return action ? *action : XDP_PASS;
+}
+
+static __always_inline void filter_stat_add(__u32 key, __u64 bytes)
+{
+	struct datarec *rec = bpf_map_lookup_elem(&xdp_filter_stat_map, &key);
+	if (rec)
+	{
+		rec->rx_pkts++;
+		rec->rx_bytes += bytes;
+	}
+}
+
+/* A definite bloom miss skips the hash, which is nearly all traffic */
+static __always_inline bool filter_match(__be32 saddr, __u64 bytes)
+{
+	__u32 zero = 0;
+	bool bloom_hit = false;
+
+	if (features.filter_bloom)
+	{
+		void *bloom = bpf_map_lookup_elem(&xdp_filter_bloom, &zero);
+		if (bloom)
+		{
+			if (bpf_map_peek_elem(bloom, &saddr))
+			{
+				filter_stat_add(FILTER_STAT_MISS, bytes);
+				return false;
+			}
+			bloom_hit = true;
+		}
+	}
+
+	void *filter = bpf_map_lookup_elem(&xdp_filter_map, &zero);
+	if (filter && bpf_map_lookup_elem(filter, &saddr))
+	{
+		filter_stat_add(FILTER_STAT_HIT, bytes);
+		return true;
+	}
+	filter_stat_add(bloom_hit ? FILTER_STAT_BLOOM_FP : FILTER_STAT_MISS, bytes);
+	return false;
+}
+
+/* Stateless L4 LB: Maglev picks the backend, L2 rewrite hands it over (DSR) */
+static __always_inline __u32 lb_forward(struct xdp_md *ctx, struct flow_v4 *flow)
+{
+	struct ethhdr *eth = flow->eth;
+	struct lb_vip_key vip = {
+		.addr = flow->iph->daddr,
+		.port = flow->dport,
+		.proto = flow->iph->protocol,
+	};
+
+	struct lb_vip_meta *meta = bpf_map_lookup_elem(&lb_vip_map, &vip);
+	if (!meta)
+	{
+		return XDP_PASS;
+	}
+
+	__u32 vip_idx = meta->vip_idx;
+	__u32 hash = flow_v4_hash(flow);
+	__u32 slot = (vip_idx * 2 + (meta->table_sel & 1)) * LB_MAGLEV_SIZE + hash % LB_MAGLEV_SIZE;
+
+	__u32 *backend_id = bpf_map_lookup_elem(&lb_maglev_map, &slot);
+	if (!backend_id)
+	{
+		return XDP_ABORTED;
+	}
+
+	__u32 id = *backend_id;
+	struct lb_backend *backend = bpf_map_lookup_elem(&lb_backend_map, &id);
+	if (!backend || !backend->addr)
+	{
+		return XDP_DROP;
+	}
+
+	__u64 bytes = ctx->data_end - ctx->data;
+	datarec_add(&lb_vip_stat_map, vip_idx, bytes);
+	datarec_add(&lb_backend_stat_map, id, bytes);
+
+	if (backend->ifindex && backend->ifindex != ctx->ingress_ifindex)
+	{
+		__builtin_memcpy(eth->h_source, backend->smac, ETH_ALEN);
+		__builtin_memcpy(eth->h_dest, backend->mac, ETH_ALEN);
+		return bpf_redirect(backend->ifindex, 0);
+	}
+
+	__builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+	__builtin_memcpy(eth->h_dest, backend->mac, ETH_ALEN);
+	return XDP_TX;
+}
+
+/* Must run last on the XDP_PASS path, it invalidates packet pointers */
+static __always_inline void xdp_meta_store(struct xdp_md *ctx, struct flow_v4 *flow, int proto)
+{
+	__u32 flow_hash = flow_v4_hash(flow);
+	__u32 class_id = FLOW_CLASS_ID(proto, bpf_ntohs(flow->dport));
+	__u16 l3_off = flow->l3_off, l4_off = flow->l4_off;
+
+	/* Not every driver reserves metadata headroom */
+	if (bpf_xdp_adjust_meta(ctx, -(int)sizeof(struct xdp_meta)))
+	{
+		return;
+	}
+
+	void *data = (void *)(long)ctx->data;
+	struct xdp_meta *meta = (void *)(long)ctx->data_meta;
+	if ((void *)(meta + 1) > data)
+	{
+		return;
+	}
+
+	meta->l3_off = l3_off;
+	meta->l4_off = l4_off;
+	meta->flow_hash = flow_hash;
+	meta->class_id = class_id;
+	meta->magic = XDP_META_MAGIC;
+}
+
+SEC("xdp_stat")
+int xdp_stat_prog(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	__u32 action = XDP_PASS;
+
+	rxq_stats_record(ctx);
+
+	struct flow_v4 flow;
+	int proto = parse_flow_v4(data, data_end, &flow);
+	if (proto < 0)
+	{
+		goto out;
+	}
+
+	if (features.tunnel_decap && tunnel_decap(ctx, &flow, proto, &action))
+	{
+		goto out;
+	}
+
+	if (features.filter && filter_match(flow.iph->saddr, data_end - data))
+	{
+		action = XDP_DROP;
+		goto out;
+	}
+
+	if (features.classifier)
+	{
+		action = cls_apply(ctx, &flow, proto);
+		if (action != XDP_PASS)
+		{
+			goto out;
+		}
+	}
+
+	/* Fragments have no ports to hash, leave reassembly to the stack */
+	if (features.lb && !flow.frag && (proto == IPPROTO_TCP || proto == IPPROTO_UDP))
+	{
+		action = lb_forward(ctx, &flow);
+	}
+
+	if (action == XDP_PASS)
+	{
+		xdp_meta_store(ctx, &flow, proto);
+	}
 
-	return XDP_PASS;
+out:
+	return xdp_stats_record_action(ctx, action);
 }
 
-char _license[] SEC("license") = "GPL";
\ No newline at end of file
+char _license[] SEC("license") = "GPL";
@@ -1,4 +1,6 @@
 #!/usr/bin/env bash
 
+# --bloom-fp needs kernel 5.16 or later and xdp_prog_kern.o built against
+# uapi headers from 5.16 or later, the other features load on older kernels
 sudo apt update
 sudo apt -y install clang llvm libelf-dev libpcap-dev gcc-multilib build-essential pkg-config